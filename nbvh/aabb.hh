@@ -24,6 +24,7 @@
 #ifndef AXIS_ALIGNED_BOUNDING_BOX_HH
 #define AXIS_ALIGNED_BOUNDING_BOX_HH
 
+#include <type_traits>
 #include "nvec.hh"
 
 ////////////////////////////////////////////////////////////////
@@ -129,6 +130,22 @@ inline bool is_intersecting(const Aabb<T, N> &b, const VectorN<T, N> &org, const
     return t1 > 0 && t1 >= t0 && dist > t0;
 }
 
+// Classify box against the half-space dot(n, x) <= d by its
+// nearest and farthest corners along the plane normal:
+// -1 if inside, +1 if outside, 0 if straddling the plane.
+
+template <typename T, size_t N>
+inline int classify(const Aabb<T, N> &b, const VectorN<T, N> &n, const T &d)
+{
+    const VectorN<T, N> c = (b[0] + b[1]) * (T)(0.5);
+    const VectorN<T, N> e = (b[1] - b[0]) * (T)(0.5);
+    const T s = dot(n, c);
+    const T r = dot(abs(n), e);
+    if (s - r > d) return +1;
+    if (s + r <= d) return -1;
+    return 0;
+}
+
 ////////////////////////////////////////////////////////////////
 /// AABB property impls
 ////////////////////////////////////////////////////////////////
@@ -153,6 +170,14 @@ template <typename T, size_t N>
 inline size_t longest_axis(const Aabb<T, N> &b)
 { return argmax(diagonal(b)); }
 
+// squared distance from point to the nearest point of box
+template <typename T, size_t N>
+inline T sqr_distance(const Aabb<T, N> &b, const VectorN<T, N> &v)
+{
+    const VectorN<T, N> d = max(b[0] - v, v - b[1], make_vector<T, N>(0));
+    return dot(d, d);
+}
+
 template <typename T, size_t N, typename Indices = std::make_index_sequence<N>>
 inline T volume(const Aabb<T, N> &b)
 { return op_impl_rdc<T, N>(diagonal(b), [] (T x, T y) { return x * y; }, (T)1, Indices{}); }
@@ -169,6 +194,22 @@ template <typename T, size_t N>
 inline Aabb<T, N> intersect(const Aabb<T, N> &b_0, const Aabb<T, N> &b_1)
 { return { max(b_0[0], b_1[0]), min(b_0[1], b_1[1]) }; }
 
+// Box enclosing the box transformed by x' = m * x + t, where m[i]
+// is the i-th row of the matrix (J. Arvo, Graphics Gems 1990).
+template <typename T, size_t N>
+inline Aabb<T, N> transform(const Aabb<T, N> &b, const VectorN<T, N> (&m)[N], const VectorN<T, N> &t)
+{
+    const VectorN<T, N> c = centroid(b);
+    const VectorN<T, N> e = diagonal(b) * (T)(0.5);
+    VectorN<T, N> c1, e1;
+    for (size_t i = 0; i < N; ++i)
+    {
+        c1[i] = dot(m[i], c) + t[i];
+        e1[i] = dot(abs(m[i]), e);
+    }
+    return { c1 - e1, c1 + e1 };
+}
+
 ////////////////////////////////////////////////////////////////
 /// AABB ctors
 ////////////////////////////////////////////////////////////////
@@ -187,6 +228,35 @@ template <typename T, size_t N, typename... R>
 inline Aabb<T, N> make_aabb(const VectorN<T, N> &v, const VectorN<R, N> &... vs)
 { return { min(v, vs...), max(v, vs...) }; }
 
+////////////////////////////////////////////////////////////////
+/// AABB precision casts
+////////////////////////////////////////////////////////////////
+
+// Boxes converted to a lower precision are rounded outward,
+// so that the result still encloses the original box.
+
+template <typename T, size_t N>
+inline const Aabb<T, N> &aabb_impl_cast(const Aabb<T, N> &b, std::true_type)
+{ return b; }
+
+template <typename T, typename S, size_t N>
+inline Aabb<T, N> aabb_impl_cast(const Aabb<S, N> &b, std::false_type)
+{
+    Aabb<T, N> r;
+    for (size_t i = 0; i < N; ++i)
+    {
+        r[0][i] = static_cast<T>(b[0][i]);
+        r[1][i] = static_cast<T>(b[1][i]);
+        if (static_cast<S>(r[0][i]) > b[0][i]) r[0][i] = std::nextafter(r[0][i], -std::numeric_limits<T>::infinity());
+        if (static_cast<S>(r[1][i]) < b[1][i]) r[1][i] = std::nextafter(r[1][i], +std::numeric_limits<T>::infinity());
+    }
+    return r;
+}
+
+template <typename T, typename S, size_t N>
+inline auto aabb_cast(const Aabb<S, N> &b) -> decltype(aabb_impl_cast<T>(b, std::is_same<T, S>()))
+{ return aabb_impl_cast<T>(b, std::is_same<T, S>()); }
+
 ////////////////////////////////////////////////////////////////
 /// 3D AABB property impls
 ////////////////////////////////////////////////////////////////
@@ -0,0 +1,114 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_ARENA_HH
+#define BVH_ARENA_HH
+
+#include <new>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <cstddef>
+
+////////////////////////////////////////////////////////////////
+/// Arena
+////////////////////////////////////////////////////////////////
+
+/// Bump allocator for scratch memory of trivial types. Memory is
+/// released back to a mark (or reset) but never returned to the
+/// system, so repeated builds stop allocating once warmed up.
+class Arena
+{
+public:
+    struct Mark { size_t block; size_t offset; };
+
+public:
+    explicit Arena(size_t blockSize = 1 << 16): mBlockSize(blockSize) {}
+
+    /// n value-initialized objects of trivial type T
+    template <typename T>
+    inline T *allocate(size_t n, const T &value = T());
+
+    inline Mark mark() const { return { mBlock, mOffset }; }
+    inline void release(const Mark &m) { mBlock = m.block; mOffset = m.offset; }
+    inline void reset() { mBlock = 0; mOffset = 0; }
+
+    inline size_t capacity() const { size_t n {}; for (const auto &b : mBlocks) n += b.size; return n; }
+
+protected:
+    struct Block { std::unique_ptr<char[]> data; size_t size; };
+
+    std::vector<Block> mBlocks;
+    size_t mBlock { 0 };  // current block
+    size_t mOffset { 0 }; // offset in current block
+    size_t mBlockSize;
+};
+
+template <typename T>
+inline T *Arena::allocate(size_t n, const T &value)
+{
+    constexpr size_t align = alignof(std::max_align_t);
+    const size_t bytes = (n * sizeof(T) + align - 1) / align * align;
+
+    // move on to the next block, which is allocated if not yet
+    while (mBlock < mBlocks.size() && mOffset + bytes > mBlocks[mBlock].size)
+    { ++mBlock; mOffset = 0; }
+
+    if (mBlock == mBlocks.size())
+    {
+        const size_t size = std::max(bytes, mBlockSize);
+        mBlocks.push_back({ std::unique_ptr<char[]>(new char[size]), size });
+    }
+
+    T *p = reinterpret_cast<T *>(mBlocks[mBlock].data.get() + mOffset);
+    mOffset += bytes;
+
+    for (size_t i = 0; i < n; ++i) new (p + i) T(value);
+    return p;
+}
+
+/// Scratch arena of the calling thread
+inline Arena &scratch_arena()
+{
+    static thread_local Arena arena;
+    return arena;
+}
+
+/// Allocations made through the scope are released on exit
+class ArenaScope
+{
+public:
+    explicit ArenaScope(Arena &arena): mArena(arena), mMark(arena.mark()) {}
+    ~ArenaScope() { mArena.release(mMark); }
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+    template <typename T>
+    inline T *allocate(size_t n, const T &value = T()) { return mArena.allocate<T>(n, value); }
+
+protected:
+    Arena &mArena;
+    Arena::Mark mMark;
+};
+
+#endif // !BVH_ARENA_HH
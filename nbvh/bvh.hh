@@ -25,9 +25,26 @@
 #define BOUNDING_VOLUME_HIERARCHY_HH
 
 #include <stack>
+#include <cassert>
+#include <cstdint>
+#include <limits>
 #include <vector>
+#include <thread>
+#include <utility>
+#include <stdexcept>
 #include <algorithm>
+#include <type_traits>
 #include "aabb.hh"
+#include "arena.hh"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NBVH_PREFETCH(p) __builtin_prefetch(p)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <xmmintrin.h>
+#define NBVH_PREFETCH(p) _mm_prefetch(reinterpret_cast<const char *>(p), _MM_HINT_T0)
+#else
+#define NBVH_PREFETCH(p)
+#endif
 
 ////////////////////////////////////////////////////////////////
 /// Bvh node
@@ -37,67 +54,210 @@
 /// child nodes in the node array respectively;
 /// When representing leaf node, i0, i1 = beginning index of object
 /// in the primitive array and NEGATIVE number of objects.
-template <typename T, size_t N>
+/// I is a signed integer type, 32-bit by default, which limits
+/// the number of nodes and primitives; use int64_t beyond that.
+template <typename T, size_t N, typename I = int>
 struct BvhNode
 {
+    static_assert(std::is_signed<I>::value, "leaf size is encoded as a negative index");
+
+    typedef T value_type;
+    typedef I index_type;
+    typedef Aabb<T, N> bound_type;
+
     Aabb<T, N> b;
-    int i0 { 0 };
-    int i1 { 0 };
+    I i0 { 0 };
+    I i1 { 0 };
 };
 
-template <typename T, size_t N>
-inline int &left_child(BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline I &left_child(BvhNode<T, N, I> &node)
 { return node.i0; }
 
-template <typename T, size_t N>
-inline const int &left_child(const BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline const I &left_child(const BvhNode<T, N, I> &node)
 { return node.i0; }
 
-template <typename T, size_t N>
-inline int &right_child(BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline I &right_child(BvhNode<T, N, I> &node)
 { return node.i1; }
 
-template <typename T, size_t N>
-inline const int &right_child(const BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline const I &right_child(const BvhNode<T, N, I> &node)
 { return node.i1; }
 
-template <typename T, size_t N>
-inline int &offset(BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline I &offset(BvhNode<T, N, I> &node)
 { return node.i0; }
 
-template <typename T, size_t N>
-inline const int &offset(const BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline const I &offset(const BvhNode<T, N, I> &node)
 { return node.i0; }
 
-template <typename T, size_t N>
-inline int &neglen(BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline I &neglen(BvhNode<T, N, I> &node)
 { return node.i1; }
 
-template <typename T, size_t N>
-inline const int &neglen(const BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline const I &neglen(const BvhNode<T, N, I> &node)
 { return node.i1; }
 
-template <typename T, size_t N>
-inline int length(const BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline I length(const BvhNode<T, N, I> &node)
 { return -node.i1; }
 
-template <typename T, size_t N>
-inline bool is_leaf(const BvhNode<T, N> &node)
+template <typename T, size_t N, typename I>
+inline bool is_leaf(const BvhNode<T, N, I> &node)
 { return neglen(node) < 0; }
 
-template <typename T, size_t N>
-inline void set_leaf(BvhNode<T, N> &node, int objIdx, int objNum)
+template <typename T, size_t N, typename I>
+inline void set_leaf(BvhNode<T, N, I> &node, I objIdx, I objNum)
 { offset(node) = objIdx; neglen(node) = -objNum; }
 
+////////////////////////////////////////////////////////////////
+/// Box transforms
+////////////////////////////////////////////////////////////////
+
+/// Maps boxes of the other tree into the frame of this tree
+/// in tree-vs-tree queries.
+struct IdentityTransform
+{
+    template <class Box>
+    inline Box operator() (const Box &b) const { return b; }
+};
+
+/// x' = m * x + t, where m[i] is the i-th row of the matrix
+template <typename T, size_t N>
+struct AffineTransform
+{
+    inline Aabb<T, N> operator() (const Aabb<T, N> &b) const { return transform(b, m, t); }
+    VectorN<T, N> m[N];
+    VectorN<T, N> t;
+};
+
+////////////////////////////////////////////////////////////////
+/// Half-space
+////////////////////////////////////////////////////////////////
+
+/// Half-space { x | dot(n, x) <= d }, a convex polytope is
+/// the intersection of a set of half-spaces.
+template <typename T, size_t N>
+struct Halfspace
+{
+    VectorN<T, N> n;
+    T d;
+};
+
+////////////////////////////////////////////////////////////////
+/// Traversal policies
+////////////////////////////////////////////////////////////////
+
+/// Policies are resolved at compile time, so every combination
+/// of them is a specialized traversal kernel without branches on
+/// options.
+
+/// Ordering: visit the left child first
+struct DepthFirst
+{
+    template <class NodeTest, class Node>
+    static inline bool left_first(const NodeTest &, const Node &) { return true; }
+};
+
+/// Ordering: visit the child nearer to the ray origin first
+/// along the split axis, NodeTest must provide `neg`.
+struct NearFirst
+{
+    template <class NodeTest, class Node>
+    static inline bool left_first(const NodeTest &test, const Node &node) { return !test.neg[longest_axis(node.b)]; }
+};
+
+/// Termination: visit every candidate leaf, with a ray query this
+/// results in the closest hit as the distance shrinks.
+struct AllHits { static constexpr bool stop = false; };
+
+/// Termination: stop at the first leaf reporting a hit
+struct AnyHit { static constexpr bool stop = true; };
+
+/// Instrumentation: none
+struct NoStats
+{
+    inline void node() {}
+    inline void leaf(size_t) {}
+};
+
+/// Instrumentation: count visited nodes, leaves and primitives
+struct TraversalStats
+{
+    inline void node() { ++nodes; }
+    inline void leaf(size_t n) { ++leaves; primitives += n; }
+    size_t nodes { 0 };
+    size_t leaves { 0 };
+    size_t primitives { 0 };
+};
+
+/// Node tests are called as test(box) or, if they take it, as
+/// test(box, node) with the node index, and leaf visits likewise
+/// as visit(ib, ie) or visit(ib, ie, node), so that trees keeping
+/// data per node in side arrays can be traversed the same way.
+template <class NodeTest, class Box, typename I>
+inline auto test_node(NodeTest &test, const Box &b, const I node, int) -> decltype(test(b, node))
+{ return test(b, node); }
+
+template <class NodeTest, class Box, typename I>
+inline bool test_node(NodeTest &test, const Box &b, const I, long)
+{ return test(b); }
+
+template <class LeafVisit, typename I>
+inline auto visit_leaf(LeafVisit &visit, const I ib, const I ie, const I node, int) -> decltype(visit(ib, ie, node))
+{ return visit(ib, ie, node); }
+
+template <class LeafVisit, typename I>
+inline bool visit_leaf(LeafVisit &visit, const I ib, const I ie, const I, long)
+{ return visit(ib, ie); }
+
+/// Node test of a ray with distance limit
+template <typename T, size_t N>
+struct RayNodeTest
+{
+    RayNodeTest(const VectorN<T, N> &org, const VectorN<T, N> &dir, const T &dist): org(org), dist(dist)
+    {
+        inv = make_vector<T, N>(1) / dir;
+        neg = make_vector<T, N, bool>(dir, [] (T x) { return x < 0; });
+    }
+    inline bool operator() (const Aabb<T, N> &b) const { return is_intersecting(b, org, inv, dist, true); }
+    VectorN<T, N> org;
+    const T &dist; // shrinks as hits are found
+    VectorN<T, N> inv;
+    VectorN<bool, N> neg;
+};
+
+/// Node test of a shape of half extents e swept along a ray: the box
+/// is inflated by e (Minkowski sum with the shape's box) and tested
+/// as for a ray. A sphere of radius r is swept as the box of e = r.
+template <typename T, size_t N>
+struct SweptNodeTest : public RayNodeTest<T, N>
+{
+    SweptNodeTest(const VectorN<T, N> &extent, const VectorN<T, N> &org, const VectorN<T, N> &dir, const T &dist):
+        RayNodeTest<T, N>(org, dir, dist), extent(extent) {}
+    inline bool operator() (const Aabb<T, N> &b) const
+    { return is_intersecting(Aabb<T, N> { b[0] - extent, b[1] + extent }, this->org, this->inv, this->dist, true); }
+    VectorN<T, N> extent;
+};
+
 ////////////////////////////////////////////////////////////////
 /// Bounding volume hierarchy
 ////////////////////////////////////////////////////////////////
 
-template <class Primitive, typename T, size_t N>
+/// T is the scalar type of primitives and queries, while Node may
+/// store bounds in a different (e.g. lower) precision, rounded
+/// outward so that they still enclose the primitives.
+template <class Primitive, typename T, size_t N, class Node = BvhNode<T, N>>
 class Bvh
 {
 public:
     typedef T value_type;
+    typedef Node node_type;
+    typedef typename Node::index_type index_type;
 
 public:
     template <class PrimitiveBound, class PrimitiveSplit>
@@ -105,7 +265,8 @@ public:
         std::vector<Primitive> &primitives,
         const PrimitiveBound &bound,
         const PrimitiveSplit &split,
-        const int threshold = 1);
+        const int threshold = 1,
+        const int max_depth = std::numeric_limits<int>::max());
 
     template <class PrimitiveBound, class PrimitiveSplit>
     inline void build( // primitives are copied
@@ -113,18 +274,52 @@ public:
         typename std::vector<Primitive>::iterator eiter,
         const PrimitiveBound &bound,
         const PrimitiveSplit &split,
-        const int threshold = 1);
+        const int threshold = 1,
+        const int max_depth = std::numeric_limits<int>::max());
+
+    /// Rebuild the smallest subtrees enclosing the new bounds of the
+    /// primitives at the given positions, which were modified in place.
+    /// Primitives may be reordered within the rebuilt subtrees.
+    /// Throws std::out_of_range for positions out of primitives().
+    /// max_depth caps the depth from the root, as in build.
+    template <class PrimitiveBound, class PrimitiveSplit>
+    inline void rebuild(
+        const std::vector<index_type> &dirty,
+        const PrimitiveBound &bound,
+        const PrimitiveSplit &split,
+        const int threshold = 1,
+        const int max_depth = std::numeric_limits<int>::max());
+
+    /// Drop nodes left unreachable by rebuild
+    inline void compact();
+
+    /// Gather trees built apart (e.g. per tile) under a SAH top tree
+    /// over their roots. Nodes and primitives of each tree are copied
+    /// as they are, the trees in the leaf order of the top tree.
+    inline void merge_trees(const std::vector<const Bvh*> &trees);
 
 protected:
     template <class PrimitiveBound, class PrimitiveSplit>
     inline void recursive_build(
         typename std::vector<Primitive>::iterator biter,
         typename std::vector<Primitive>::iterator eiter,
-        const int current_node_id,
-        const int current_tree_depth,
+        const index_type current_node_id,
+        const index_type current_tree_depth,
         const PrimitiveBound &bound,
         const PrimitiveSplit &split,
-        const int threshold);
+        const int threshold,
+        const int max_depth);
+
+    typedef std::vector<std::pair<Aabb<T, N>, size_t>> root_list; // box, tree
+
+    inline index_type merge_top(
+        typename root_list::iterator biter,
+        typename root_list::iterator eiter,
+        const std::vector<const Bvh*> &trees,
+        std::vector<Node> &nodes,
+        std::vector<size_t> &order,
+        index_type &next,
+        index_type &base) const;
 
 public:
     template <class PrimitiveCollide>
@@ -134,48 +329,158 @@ public:
         const VectorN<T, N> &dir,
         T &dist) const;
 
+    template <class LeafCollide>
+    inline bool intersect_leaves(
+        LeafCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        T &dist) const;
+
+    template <class PrimitiveCollide>
+    inline bool occluded( // stops at any hit
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        T &dist) const;
+
+    /// Up to k nearest hits as (distance, position in primitives()),
+    /// sorted along the ray. Nodes beyond the k-th hit are pruned.
+    template <class PrimitiveCollide>
+    inline size_t intersect_multi(
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        std::vector<std::pair<T, index_type>> &hits,
+        const size_t k,
+        const T dist = std::numeric_limits<T>::max()) const;
+
+    /// Sweep a shape of half extents from org along dir, and find the
+    /// earliest time of impact, as reported by collide, in dist.
+    template <class PrimitiveCollide>
+    inline bool sweep(
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &extent,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        T &dist) const;
+
+    template <class Order, class Termination, class NodeTest, class LeafVisit, class Stats>
+    inline bool traverse(
+        NodeTest &test,
+        LeafVisit &visit,
+        Stats &stats,
+        const index_type root = 0) const; // node to start from
+
+    template <class Order, class Termination, class NodeTest, class LeafVisit>
+    inline bool traverse(
+        NodeTest &test,
+        LeafVisit &visit) const;
+
     template <class RangeQuery>
     inline bool search(RangeQuery &range) const;
 
+    template <class Other, class OtherNode, class PrimitiveOverlap, class BoxTransform = IdentityTransform>
+    inline bool overlap( // tree vs tree
+        const Bvh<Other, T, N, OtherNode> &other,
+        PrimitiveOverlap &overlap,
+        const BoxTransform &transform = BoxTransform(),
+        const int threads = 1) const;
+
+    template <class PrimitiveOverlap>
+    inline bool overlap( // tree vs itself
+        PrimitiveOverlap &overlap,
+        const int threads = 1) const;
+
+    template <class PolytopeQuery>
+    inline bool cull(
+        PolytopeQuery &query,
+        const std::vector<Halfspace<T, N>> &planes) const;
+
+    template <class BatchCollide>
+    inline size_t intersect_batch(
+        BatchCollide &collide,
+        const VectorN<T, N> *orgs,
+        const VectorN<T, N> *dirs,
+        T *dists,
+        const size_t n,
+        const int lanes = 8) const;
+
+    template <class RangeQuery>
+    inline size_t search_batch(
+        RangeQuery *queries,
+        const size_t n,
+        const int lanes = 8) const;
+
     inline std::vector<Primitive> &primitives() { return mPrimitives; }
     inline const std::vector<Primitive> &primitives() const { return mPrimitives; }
 
-    inline std::vector<BvhNode<T, N>> &nodes() { return mNodes; }
-    inline const std::vector<BvhNode<T, N>> &nodes() const { return mNodes; }
+    inline std::vector<Node> &nodes() { return mNodes; }
+    inline const std::vector<Node> &nodes() const { return mNodes; }
 
-    inline Aabb<T, N> aabb() const { return mNodes.size() > 0 ? mNodes[0].b : make_aabb<T, N>(); }
+    inline Aabb<T, N> aabb() const { return mNodes.size() > 0 ? aabb_cast<T>(mNodes[0].b) : make_aabb<T, N>(); }
+    inline size_t garbage() const { return mGarbage; } // #node unreachable from root
     inline bool is_empty() const { return mNodes.empty(); }
+    inline void clear() { mPrimitives.clear(); mNodes.clear(); mGarbage = 0; } // memory is kept
+
+protected:
+    template <class Enter, class Visit>
+    inline void interleave(
+        const size_t n,
+        const int lanes,
+        Enter &enter,
+        Visit &visit) const;
+
+    template <class Other, class OtherNode, class PrimitiveOverlap, class BoxTransform>
+    inline bool overlap_traverse(
+        const Bvh<Other, T, N, OtherNode> &other,
+        PrimitiveOverlap &overlap,
+        const BoxTransform &transform,
+        const bool self,
+        const int threads) const;
+
+    template <class Other, class OtherNode, class PrimitiveOverlap, class BoxTransform, class PairPush>
+    inline bool overlap_visit(
+        const Bvh<Other, T, N, OtherNode> &other,
+        PrimitiveOverlap &overlap,
+        const BoxTransform &transform,
+        const index_type a,
+        const index_type b,
+        const bool self,
+        PairPush &push) const;
 
 protected:
     std::vector<Primitive> mPrimitives;
-    std::vector<BvhNode<T, N>> mNodes;
+    std::vector<Node> mNodes;
+    size_t mGarbage {};
 };
 
 ////////////////////////////////////////////////////////////////
 /// Bvh build
 ////////////////////////////////////////////////////////////////
 
-template <class Primitive, typename T, size_t N>
+template <class Primitive, typename T, size_t N, class Node>
 template <class PrimitiveBound, class PrimitiveSplit>
-inline void Bvh<Primitive, T, N>::recursive_build(
+inline void Bvh<Primitive, T, N, Node>::recursive_build(
     typename std::vector<Primitive>::iterator biter,
     typename std::vector<Primitive>::iterator eiter,
-    const int curr,  // current bvh node id
-    const int depth, // current tree depth
+    const index_type curr,  // current bvh node id
+    const index_type depth, // current tree depth
     const PrimitiveBound &bound,
     const PrimitiveSplit &split,
-    const int threshold)
+    const int threshold,
+    const int max_depth)
 {
-    const int n = static_cast<int>(std::distance(biter, eiter));
-    const int m = static_cast<int>(std::distance(mPrimitives.begin(), biter));
+    const auto n = static_cast<index_type>(std::distance(biter, eiter));
+    const auto m = static_cast<index_type>(std::distance(mPrimitives.begin(), biter));
 
     // Split primitives into left and right children nodes at splitting index
     auto piter = eiter;
-    if (n > threshold) piter = split(mPrimitives, biter, eiter);
+    if (n > threshold && depth < max_depth) piter = split(mPrimitives, biter, eiter);
 
     // Make Bvh leaf node if:
     // 1. #primitive is less than threshold, there is no need to split anymore;
-    // 2. split method failed to split primitives into 2 sets(which causes #primitive > threshold).
+    // 2. the tree is as deep as allowed;
+    // 3. split method failed (or declined, e.g. by SAH cost) to split primitives into 2 sets.
     // To make #primitive per node strictly less than threshold, one needs a split method that
     // will certainly perform a successful split, like EqualCount method.
     if (piter == biter || piter == eiter)
@@ -184,145 +489,913 @@ inline void Bvh<Primitive, T, N>::recursive_build(
         auto bbox = make_aabb<T, N>();
         for (auto iter = biter; iter != eiter; ++iter)
             bbox = merge(bbox, bound(*iter));
-        mNodes[curr].b = bbox;
+        mNodes[curr].b = aabb_cast<typename Node::value_type>(bbox);
+    }
+    else // Build Bvh recursively after splitting primitives
+    {
+        mNodes[curr].b = make_aabb<typename Node::value_type, N>();
+
+        auto left = static_cast<index_type>(mNodes.size());
+        left_child(mNodes[curr]) = left;
+        mNodes.emplace_back();
+
+        recursive_build(biter, piter, left, depth + 1, bound, split, threshold, max_depth);
+        mNodes[curr].b = merge(mNodes[curr].b, mNodes[left].b);
+
+        auto right = static_cast<index_type>(mNodes.size());
+        right_child(mNodes[curr]) = right;
+        mNodes.emplace_back();
+
+        recursive_build(piter, eiter, right, depth + 1, bound, split, threshold, max_depth);
+        mNodes[curr].b = merge(mNodes[curr].b, mNodes[right].b);
+    }
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveBound, class PrimitiveSplit>
+inline void Bvh<Primitive, T, N, Node>::build(
+    std::vector<Primitive> &primitives,
+    const PrimitiveBound &bound,
+    const PrimitiveSplit &split,
+    const int threshold,
+    const int max_depth)
+{
+    if (primitives.empty()) return;
+    std::swap(primitives, mPrimitives);
+    mNodes.clear(); mNodes.reserve(2 * mPrimitives.size() - 1); // upper bound of #node
+    mNodes.emplace_back(); mGarbage = 0;
+    recursive_build(mPrimitives.begin(), mPrimitives.end(), 0, 0, bound, split, threshold, max_depth);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveBound, class PrimitiveSplit>
+inline void Bvh<Primitive, T, N, Node>::build(
+    typename std::vector<Primitive>::iterator biter,
+    typename std::vector<Primitive>::iterator eiter,
+    const PrimitiveBound &bound,
+    const PrimitiveSplit &split,
+    const int threshold,
+    const int max_depth)
+{
+    if (biter == eiter) return;
+    mPrimitives.assign(biter, eiter);
+    mNodes.clear(); mNodes.reserve(2 * mPrimitives.size() - 1); // upper bound of #node
+    mNodes.emplace_back(); mGarbage = 0;
+    recursive_build(mPrimitives.begin(), mPrimitives.end(), 0, 0, bound, split, threshold, max_depth);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveBound, class PrimitiveSplit>
+inline void Bvh<Primitive, T, N, Node>::rebuild(
+    const std::vector<index_type> &dirty,
+    const PrimitiveBound &bound,
+    const PrimitiveSplit &split,
+    const int threshold,
+    const int max_depth)
+{
+    if (mNodes.empty() || dirty.empty()) return;
+
+    struct Subtree
+    {
+        index_type node, ib, ie, depth;
+        std::vector<index_type> ancestors; // root first
+    };
+
+    // ranges of primitives below the nodes, taken once from the leaves;
+    // every subtree must hold one contiguous range
+    typedef std::pair<index_type, index_type> Range;
+    std::vector<Range> ranges(mNodes.size());
+    std::vector<index_type> order; // parents before children
+    order.reserve(mNodes.size() - mGarbage);
+
+    std::stack<index_type> recursive({ 0 });
+    while (!recursive.empty())
+    {
+        auto curr = recursive.top(); recursive.pop();
+        order.push_back(curr);
+        if (!is_leaf(mNodes[curr]))
+        {
+            recursive.push(right_child(mNodes[curr]));
+            recursive.push(left_child(mNodes[curr]));
+        }
+    }
+
+    for (auto iter = order.rbegin(); iter != order.rend(); ++iter)
+    {
+        const auto &node = mNodes[*iter]; // safe reference
+        if (is_leaf(node))
+        {
+            ranges[*iter] = { offset(node), offset(node) + length(node) };
+        }
+        else
+        {
+            const auto &l = ranges[left_child(node)];
+            const auto &r = ranges[right_child(node)];
+            assert(l.second == r.first);
+            ranges[*iter] = { l.first, r.second };
+        }
+    }
+
+    std::vector<Subtree> subtrees;
+    std::vector<index_type> path;
+
+    for (const auto p : dirty)
+    {
+        if (p < 0 || static_cast<size_t>(p) >= mPrimitives.size())
+            throw std::out_of_range("rebuild: dirty position out of primitives");
+
+        // descend to the leaf holding the primitive
+        path.assign(1, 0);
+
+        while (!is_leaf(mNodes[path.back()]))
+        {
+            const auto &node = mNodes[path.back()]; // safe reference
+            const auto left = left_child(node);
+            path.push_back(p < ranges[left].second ? left : right_child(node));
+        }
+
+        // ascend until the node encloses the new bound
+        const auto bbox = bound(mPrimitives[p]);
+        size_t k = path.size() - 1;
+        while (k > 0 && !is_inside(aabb_cast<T>(mNodes[path[k]].b), bbox)) --k;
+
+        const auto &range = ranges[path[k]];
+        subtrees.push_back({ path[k], range.first, range.second, static_cast<index_type>(k), {} });
+        subtrees.back().ancestors.assign(path.begin(), path.begin() + k);
+    }
+
+    // ranges of subtrees are either nested or disjoint, keep the outermost
+    std::sort(subtrees.begin(), subtrees.end(), [](const Subtree &a, const Subtree &b)
+    { return a.ib < b.ib || (a.ib == b.ib && a.ie > b.ie); });
+
+    size_t n {};
+    for (size_t i = 0; i < subtrees.size(); ++i)
+        if (n == 0 || subtrees[i].ib >= subtrees[n - 1].ie)
+            std::swap(subtrees[n++], subtrees[i]);
+    subtrees.resize(n);
+
+    for (const auto &subtree : subtrees)
+    {
+        // nodes below the root are abandoned, the root is reused
+        std::stack<index_type> recursive({ subtree.node });
+        while (!recursive.empty())
+        {
+            auto curr = recursive.top(); recursive.pop();
+            if (curr != subtree.node) ++mGarbage;
+            if (!is_leaf(mNodes[curr]))
+            {
+                recursive.push(left_child(mNodes[curr]));
+                recursive.push(right_child(mNodes[curr]));
+            }
+        }
+
+        // starts at the depth of the subtree root, so the subtree
+        // gets max_depth less that depth
+        recursive_build(
+            mPrimitives.begin() + subtree.ib, mPrimitives.begin() + subtree.ie,
+            subtree.node, subtree.depth, bound, split, threshold, max_depth);
+    }
+
+    // refit ancestors bottom-up
+    for (const auto &subtree : subtrees)
+    {
+        for (auto iter = subtree.ancestors.rbegin(); iter != subtree.ancestors.rend(); ++iter)
+        {
+            auto &node = mNodes[*iter];
+            node.b = merge(mNodes[left_child(node)].b, mNodes[right_child(node)].b);
+        }
+    }
+
+    if (mGarbage > mNodes.size() - mGarbage) compact();
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline void Bvh<Primitive, T, N, Node>::compact()
+{
+    if (mGarbage == 0) return;
+
+    // renumber in the order of building: parent, left subtree, right subtree
+    std::vector<Node> nodes;
+    nodes.reserve(mNodes.size() - mGarbage);
+
+    struct Entry { index_type node, parent; bool left; }; // parent is renumbered
+    std::stack<Entry> recursive({ { 0, -1, true } });
+
+    while (!recursive.empty())
+    {
+        auto curr = recursive.top(); recursive.pop();
+        const auto next = static_cast<index_type>(nodes.size());
+        nodes.push_back(mNodes[curr.node]);
+
+        if (curr.parent >= 0)
+        {
+            if (curr.left) left_child(nodes[curr.parent]) = next;
+            else right_child(nodes[curr.parent]) = next;
+        }
+
+        if (!is_leaf(mNodes[curr.node]))
+        {
+            recursive.push({ right_child(mNodes[curr.node]), next, false });
+            recursive.push({ left_child(mNodes[curr.node]), next, true });
+        }
+    }
+
+    std::swap(nodes, mNodes);
+    mGarbage = 0;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline void Bvh<Primitive, T, N, Node>::merge_trees(const std::vector<const Bvh*> &trees)
+{
+    std::vector<const Bvh*> inputs;
+    for (auto tree : trees)
+        if (tree && !tree->is_empty())
+            inputs.push_back(tree);
+
+    // top nodes go first so that node 0 stays the root, then the
+    // trees follow one after another with their indices shifted
+    const size_t k = inputs.size();
+    size_t nNodes = k > 0 ? k - 1 : 0, nPrimitives = 0, garbage = 0;
+    for (auto tree : inputs)
+    {
+        nNodes += tree->mNodes.size();
+        nPrimitives += tree->mPrimitives.size();
+        garbage += tree->mGarbage;
+    }
+
+    std::vector<Node> nodes(k > 0 ? k - 1 : 0);
+    std::vector<Primitive> primitives;
+    nodes.reserve(nNodes);
+    primitives.reserve(nPrimitives);
+
+    // lay the trees out in the leaf order of the top tree, so that
+    // every subtree of the merged tree holds contiguous primitives
+    root_list roots;
+    for (size_t i = 0; i < k; ++i)
+        roots.push_back({ inputs[i]->aabb(), i });
+
+    std::vector<size_t> order;
+    index_type next {}, base = static_cast<index_type>(nodes.size());
+    if (k > 0) merge_top(roots.begin(), roots.end(), inputs, nodes, order, next, base);
+
+    for (auto i : order)
+    {
+        const auto tree = inputs[i];
+        const auto no = static_cast<index_type>(nodes.size());
+        const auto po = static_cast<index_type>(primitives.size());
+        primitives.insert(primitives.end(), tree->mPrimitives.begin(), tree->mPrimitives.end());
+
+        for (auto node : tree->mNodes)
+        {
+            if (is_leaf(node)) offset(node) += po;
+            else { left_child(node) += no; right_child(node) += no; }
+            nodes.push_back(node);
+        }
+    }
+
+    // children of top nodes are stored after them, fit bottom-up
+    for (size_t i = k > 0 ? k - 1 : 0; i-- > 0;)
+        nodes[i].b = merge(nodes[left_child(nodes[i])].b, nodes[right_child(nodes[i])].b);
+
+    std::swap(nodes, mNodes);
+    std::swap(primitives, mPrimitives);
+    mGarbage = garbage;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline typename Bvh<Primitive, T, N, Node>::index_type Bvh<Primitive, T, N, Node>::merge_top(
+    typename root_list::iterator biter,
+    typename root_list::iterator eiter,
+    const std::vector<const Bvh*> &trees,
+    std::vector<Node> &nodes,
+    std::vector<size_t> &order,
+    index_type &next,
+    index_type &base) const
+{
+    typedef typename root_list::value_type Root;
+    const auto n = static_cast<size_t>(std::distance(biter, eiter));
+
+    // a tree goes right after the trees of the leaves on its left
+    if (n == 1)
+    {
+        const auto root = base;
+        order.push_back(biter->second);
+        base += static_cast<index_type>(trees[biter->second]->mNodes.size());
+        return root;
+    }
+
+    // few roots, so sweep every axis for the exact SAH split. Each
+    // tree counts once whatever its size: its own cost is the same
+    // under any top tree, only the areas of the top nodes vary
+    std::vector<T> areas(n);
+    T minCost = std::numeric_limits<T>::max();
+    size_t splitDim = 0;
+    size_t splitCount = n / 2;
+
+    for (size_t dim = 0; dim < N; ++dim)
+    {
+        std::sort(biter, eiter, [dim](const Root &a, const Root &b)
+        { return centroid(a.first)[dim] < centroid(b.first)[dim]; });
+
+        auto bbox = make_aabb<T, N>();
+        for (size_t i = n - 1; i > 0; --i)
+        {
+            bbox = merge(bbox, (biter + i)->first);
+            areas[i] = area(bbox);
+        }
+
+        bbox = make_aabb<T, N>();
+        for (size_t i = 1; i < n; ++i)
+        {
+            bbox = merge(bbox, (biter + i - 1)->first);
+            T cost = area(bbox) * (T)i + areas[i] * (T)(n - i);
+            if (minCost > cost) { minCost = cost; splitDim = dim; splitCount = i; }
+        }
+    }
+
+    std::sort(biter, eiter, [splitDim](const Root &a, const Root &b)
+    { return centroid(a.first)[splitDim] < centroid(b.first)[splitDim]; });
+
+    const auto curr = next++;
+    const auto left = merge_top(biter, biter + splitCount, trees, nodes, order, next, base);
+    const auto right = merge_top(biter + splitCount, eiter, trees, nodes, order, next, base);
+    left_child(nodes[curr]) = left;
+    right_child(nodes[curr]) = right;
+    return curr;
+}
+
+////////////////////////////////////////////////////////////////
+/// Bvh query
+////////////////////////////////////////////////////////////////
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class Order, class Termination, class NodeTest, class LeafVisit, class Stats>
+inline bool Bvh<Primitive, T, N, Node>::traverse(
+    NodeTest &test,
+    LeafVisit &visit,
+    Stats &stats,
+    const index_type root) const
+{
+    if (mNodes.empty()) return false;
+
+    bool hit { false };
+    std::stack<index_type> recursive({ root });
+
+    while (!recursive.empty())
+    {
+        auto curr = recursive.top(); recursive.pop();
+        const auto &node = mNodes[curr]; // safe reference
+
+        stats.node();
+
+        if (test_node(test, aabb_cast<T>(node.b), curr, 0))
+        {
+            if (is_leaf(node))
+            {
+                auto ib = offset(node);
+                auto ie = ib + length(node);
+
+                stats.leaf(ie - ib);
+
+                if (visit_leaf(visit, ib, ie, curr, 0))
+                {
+                    hit = true;
+                    if (Termination::stop) break;
+                }
+            }
+            else if (Order::left_first(test, node))
+            {
+                recursive.push(right_child(node));
+                recursive.push(left_child(node));
+            }
+            else
+            {
+                recursive.push(left_child(node));
+                recursive.push(right_child(node));
+            }
+        }
+    }
+
+    return hit;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class Order, class Termination, class NodeTest, class LeafVisit>
+inline bool Bvh<Primitive, T, N, Node>::traverse(
+    NodeTest &test,
+    LeafVisit &visit) const
+{
+    NoStats stats;
+    return traverse<Order, Termination>(test, visit, stats);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class RangeQuery>
+inline bool Bvh<Primitive, T, N, Node>::search(RangeQuery &query) const
+{
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (query(mPrimitives[i]))
+                hit = true;
+        return hit;
+    };
+
+    return traverse<DepthFirst, AllHits>(query, visit);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class LeafCollide>
+inline bool Bvh<Primitive, T, N, Node>::intersect_leaves(
+    LeafCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist) const
+{
+    RayNodeTest<T, N> test(org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie) { return collide(ib, ie, org, dir, dist); };
+
+    return traverse<NearFirst, AllHits>(test, visit);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveCollide>
+inline size_t Bvh<Primitive, T, N, Node>::intersect_multi(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    std::vector<std::pair<T, index_type>> &hits,
+    const size_t k,
+    const T dist) const
+{
+    hits.clear();
+    if (k == 0) return 0;
+
+    T cutoff = dist; // distance of the k-th hit once the buffer is full
+    RayNodeTest<T, N> test(org, dir, cutoff);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+        {
+            T d = cutoff;
+            if (!collide(mPrimitives[i], org, dir, d)) continue;
+
+            auto iter = std::upper_bound(hits.begin(), hits.end(), d,
+                [](const T &x, const std::pair<T, index_type> &h) { return x < h.first; });
+            hits.insert(iter, { d, i });
+            if (hits.size() > k) hits.pop_back();
+            if (hits.size() == k) cutoff = hits.back().first;
+            hit = true;
+        }
+        return hit;
+    };
+
+    traverse<NearFirst, AllHits>(test, visit);
+    return hits.size();
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveCollide>
+inline bool Bvh<Primitive, T, N, Node>::sweep(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &extent,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist) const
+{
+    SweptNodeTest<T, N> test(extent, org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (collide(mPrimitives[i], org, dir, dist))
+                hit = true;
+        return hit;
+    };
+
+    return traverse<NearFirst, AllHits>(test, visit);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveCollide>
+inline bool Bvh<Primitive, T, N, Node>::occluded(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist) const
+{
+    RayNodeTest<T, N> test(org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        for (auto i = ib; i < ie; ++i)
+            if (collide(mPrimitives[i], org, dir, dist))
+                return true;
+        return false;
+    };
+
+    return traverse<DepthFirst, AnyHit>(test, visit);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class Other, class OtherNode, class PrimitiveOverlap, class BoxTransform, class PairPush>
+inline bool Bvh<Primitive, T, N, Node>::overlap_visit(
+    const Bvh<Other, T, N, OtherNode> &other,
+    PrimitiveOverlap &overlap,
+    const BoxTransform &transform,
+    const index_type a,  // node id in this tree
+    const index_type b,  // node id in the other tree
+    const bool self,
+    PairPush &push) const
+{
+    const auto &na = mNodes[a]; // safe reference
+    const auto &nb = other.nodes()[b]; // safe reference
+
+    bool hit { false };
+
+    // A subtree against itself: test pairs within the leaf
+    // or test both children against themselves and each other.
+    if (self && a == b)
+    {
+        if (is_leaf(na))
+        {
+            auto ib = offset(na);
+            auto ie = ib + length(na);
+            for (auto i = ib; i < ie; ++i)
+                for (auto j = i + 1; j < ie; ++j)
+                    if (overlap(mPrimitives[i], mPrimitives[j]))
+                        hit = true;
+        }
+        else
+        {
+            push(left_child(na), left_child(na));
+            push(right_child(na), right_child(na));
+            push(left_child(na), right_child(na));
+        }
+
+        return hit;
+    }
+
+    const auto &ba = aabb_cast<T>(na.b);
+    const auto bb = transform(aabb_cast<T>(nb.b));
+
+    if (!is_intersecting(ba, bb)) return false;
+
+    if (is_leaf(na) && is_leaf(nb))
+    {
+        auto iab = offset(na), iae = iab + length(na);
+        auto ibb = offset(nb), ibe = ibb + length(nb);
+        for (auto i = iab; i < iae; ++i)
+            for (auto j = ibb; j < ibe; ++j)
+                if (overlap(mPrimitives[i], other.primitives()[j]))
+                    hit = true;
+    }
+    else if (is_leaf(nb) || (!is_leaf(na) && max_component(ba) >= max_component(bb)))
+    {
+        // descend the larger node
+        push(left_child(na), b);
+        push(right_child(na), b);
+    }
+    else
+    {
+        push(a, left_child(nb));
+        push(a, right_child(nb));
+    }
+
+    return hit;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class Other, class OtherNode, class PrimitiveOverlap, class BoxTransform>
+inline bool Bvh<Primitive, T, N, Node>::overlap_traverse(
+    const Bvh<Other, T, N, OtherNode> &other,
+    PrimitiveOverlap &overlap,
+    const BoxTransform &transform,
+    const bool self,
+    const int threads) const
+{
+    if (mNodes.empty() || other.is_empty()) return false;
+
+    bool hit { false };
+    std::vector<std::pair<index_type, index_type>> frontier { { 0, 0 } };
+
+    // Expand node pairs breadth-first until every thread gets
+    // a few independent subproblems to traverse on its own.
+    if (threads > 1)
+    {
+        std::vector<std::pair<index_type, index_type>> next;
+        auto push = [&] (index_type a, index_type b) { next.emplace_back(a, b); };
+
+        while (!frontier.empty() && frontier.size() < static_cast<size_t>(threads) * 4)
+        {
+            next.clear();
+            for (const auto &p : frontier)
+                if (overlap_visit(other, overlap, transform, p.first, p.second, self, push))
+                    hit = true;
+            std::swap(frontier, next);
+        }
     }
-    else // Build Bvh recursively after splitting primitives
+
+    auto traverse = [&] (size_t first, size_t step)
     {
-        mNodes[curr].b = make_aabb<T, N>();
+        bool hit { false };
+        std::stack<std::pair<index_type, index_type>> recursive;
+        auto push = [&] (index_type a, index_type b) { recursive.emplace(a, b); };
 
-        int left = static_cast<int>(mNodes.size());
-        left_child(mNodes[curr]) = left;
-        mNodes.emplace_back();
+        for (size_t k = first; k < frontier.size(); k += step)
+        {
+            recursive.push(frontier[k]);
 
-        recursive_build(biter, piter, left, depth + 1, bound, split, threshold);
-        mNodes[curr].b = merge(mNodes[curr].b, mNodes[left].b);
+            while (!recursive.empty())
+            {
+                auto curr = recursive.top(); recursive.pop();
+                if (overlap_visit(other, overlap, transform, curr.first, curr.second, self, push))
+                    hit = true;
+            }
+        }
 
-        int right = static_cast<int>(mNodes.size());
-        right_child(mNodes[curr]) = right;
-        mNodes.emplace_back();
+        return hit;
+    };
 
-        recursive_build(piter, eiter, right, depth + 1, bound, split, threshold);
-        mNodes[curr].b = merge(mNodes[curr].b, mNodes[right].b);
-    }
+    if (threads <= 1 || frontier.size() <= 1)
+        return traverse(0, 1) || hit;
+
+    std::vector<std::thread> workers;
+    std::vector<char> hits(threads, 0);
+
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] { hits[t] = traverse(t, threads); });
+
+    for (auto &worker : workers) worker.join();
+
+    for (char h : hits) if (h) hit = true;
+
+    return hit;
 }
 
-template <class Primitive, typename T, size_t N>
-template <class PrimitiveBound, class PrimitiveSplit>
-inline void Bvh<Primitive, T, N>::build(
-    std::vector<Primitive> &primitives,
-    const PrimitiveBound &bound,
-    const PrimitiveSplit &split,
-    const int threshold)
+template <class Primitive, typename T, size_t N, class Node>
+template <class Other, class OtherNode, class PrimitiveOverlap, class BoxTransform>
+inline bool Bvh<Primitive, T, N, Node>::overlap(
+    const Bvh<Other, T, N, OtherNode> &other,
+    PrimitiveOverlap &overlap,
+    const BoxTransform &transform,
+    const int threads) const
 {
-    if (primitives.empty()) return;
-    std::swap(primitives, mPrimitives); mNodes.emplace_back();
-    recursive_build(mPrimitives.begin(), mPrimitives.end(), 0, 0, bound, split, threshold);
+    return overlap_traverse(other, overlap, transform, false, threads);
 }
 
-template <class Primitive, typename T, size_t N>
-template <class PrimitiveBound, class PrimitiveSplit>
-inline void Bvh<Primitive, T, N>::build(
-    typename std::vector<Primitive>::iterator biter,
-    typename std::vector<Primitive>::iterator eiter,
-    const PrimitiveBound &bound,
-    const PrimitiveSplit &split,
-    const int threshold)
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveOverlap>
+inline bool Bvh<Primitive, T, N, Node>::overlap(
+    PrimitiveOverlap &overlap,
+    const int threads) const
 {
-    if (biter == eiter) return;
-    mPrimitives.clear(); mNodes.emplace_back();
-    std::copy(biter, eiter, std::back_inserter(mPrimitives));
-    recursive_build(mPrimitives.begin(), mPrimitives.end(), 0, 0, bound, split, threshold);
+    return overlap_traverse(*this, overlap, IdentityTransform(), true, threads);
 }
 
-////////////////////////////////////////////////////////////////
-/// Bvh query
-////////////////////////////////////////////////////////////////
-
-template <class Primitive, typename T, size_t N>
-template <class RangeQuery>
-inline bool Bvh<Primitive, T, N>::search(RangeQuery &query) const
+template <class Primitive, typename T, size_t N, class Node>
+template <class PolytopeQuery>
+inline bool Bvh<Primitive, T, N, Node>::cull(
+    PolytopeQuery &query,
+    const std::vector<Halfspace<T, N>> &planes) const
 {
     if (mNodes.empty()) return false;
 
+    // Planes that a node is fully inside are dropped from the mask
+    // for its descendants. Only the first 64 planes are tracked by
+    // the mask, the rest are tested at every node.
+    typedef unsigned long long Mask;
+    constexpr size_t nBits = sizeof(Mask) * 8;
+    const size_t nPlanes = planes.size();
+    const Mask full = nPlanes < nBits ? (Mask(1) << nPlanes) - 1 : ~Mask(0);
+
+    struct Entry { index_type node; Mask mask; bool contained; };
+
     bool hit { false };
-    std::stack<int> recursive({ 0 });
+    std::stack<Entry> recursive({ { 0, full, nPlanes == 0 } });
 
     while (!recursive.empty())
     {
-        int curr = recursive.top(); recursive.pop();
-        const auto &node = mNodes[curr]; // safe reference
+        auto curr = recursive.top(); recursive.pop();
+        const auto &node = mNodes[curr.node]; // safe reference
 
-        if (query(node.b))
+        if (!curr.contained)
         {
-            if (is_leaf(node))
-            {
-                int ib = offset(node);
-                int ie = ib + length(node);
-                for (int i = ib; i < ie; ++i)
-                    if (query(mPrimitives[i]))
-                        hit = true;
-            }
-            else
+            bool outside { false };
+            bool straddle { false };
+
+            for (size_t i = 0; i < nPlanes && !outside; ++i)
             {
-                recursive.push(right_child(node));
-                recursive.push(left_child(node));
+                const bool tracked = i < nBits;
+                if (tracked && !((curr.mask >> i) & 1)) continue;
+
+                const int side = classify(aabb_cast<T>(node.b), planes[i].n, planes[i].d);
+
+                if (side > 0) outside = true;
+                else if (side < 0 && tracked) curr.mask &= ~(Mask(1) << i);
+                else if (side == 0) straddle = true;
             }
+
+            if (outside) continue;
+
+            // the whole subtree is inside all planes, no more tests
+            curr.contained = !straddle;
+        }
+
+        if (is_leaf(node))
+        {
+            auto ib = offset(node);
+            auto ie = ib + length(node);
+            for (auto i = ib; i < ie; ++i)
+                if (query(mPrimitives[i], curr.contained))
+                    hit = true;
+        }
+        else
+        {
+            recursive.push({ right_child(node), curr.mask, curr.contained });
+            recursive.push({ left_child(node), curr.mask, curr.contained });
         }
     }
 
     return hit;
 }
 
-template <class Primitive, typename T, size_t N>
+template <class Primitive, typename T, size_t N, class Node>
 template <class PrimitiveCollide>
-inline bool Bvh<Primitive, T, N>::intersect(
+inline bool Bvh<Primitive, T, N, Node>::intersect(
     PrimitiveCollide &collide,
     const VectorN<T, N> &org,
     const VectorN<T, N> &dir,
     T &dist) const
 {
-    if (mNodes.empty()) return false;
+    auto leaf = [&] (index_type ib, index_type ie, const VectorN<T, N> &org, const VectorN<T, N> &dir, T &dist)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (collide(mPrimitives[i], org, dir, dist))
+                hit = true;
+        return hit;
+    };
+
+    return intersect_leaves(leaf, org, dir, dist);
+}
 
-    const auto neg = make_vector<T, N, bool>(dir, [] (T x) { return x < 0; });
-    const auto inv = make_vector<T, N>(1) / dir;
+////////////////////////////////////////////////////////////////
+/// Bvh batch query
+////////////////////////////////////////////////////////////////
 
-    bool hit { false };
-    std::stack<int> recursive({ 0 });
+/// Run n queries as interleaved state machines, one per lane.
+/// After a lane pops its next node, the node is prefetched and
+/// the other lanes advance by one node each before it is touched,
+/// so the cache miss of one query overlaps the work of the others.
+/// Trees that fit in cache have no misses to hide, and there the
+/// lane bookkeeping makes batches slower than single queries.
+/// enter(lane, q) sets up query q on the lane;
+/// visit(lane, q, node, stack) processes a node and pushes children.
+template <class Primitive, typename T, size_t N, class Node>
+template <class Enter, class Visit>
+inline void Bvh<Primitive, T, N, Node>::interleave(
+    const size_t n,
+    const int lanes,
+    Enter &enter,
+    Visit &visit) const
+{
+    if (mNodes.empty() || n == 0) return;
 
-    while (!recursive.empty())
+    std::vector<std::vector<index_type>> stacks(std::max(lanes, 1));
+    std::vector<size_t> queries(stacks.size());
+
+    size_t next { 0 };
+    size_t active { 0 };
+
+    for (size_t l = 0; l < stacks.size() && next < n; ++l, ++active)
+    {
+        queries[l] = next;
+        enter(l, next++);
+        stacks[l].push_back(0);
+    }
+
+    while (active > 0)
+    {
+        for (size_t l = 0; l < stacks.size(); ++l)
+        {
+            auto &stack = stacks[l];
+            if (stack.empty()) continue;
+
+            const auto curr = stack.back(); stack.pop_back();
+            visit(l, queries[l], curr, stack);
+
+            if (!stack.empty())
+            {
+                NBVH_PREFETCH(&mNodes[stack.back()]);
+            }
+            else if (next < n) // lane is free for the next query
+            {
+                queries[l] = next;
+                enter(l, next++);
+                stack.push_back(0);
+            }
+            else --active;
+        }
+    }
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class BatchCollide>
+inline size_t Bvh<Primitive, T, N, Node>::intersect_batch(
+    BatchCollide &collide,
+    const VectorN<T, N> *orgs,
+    const VectorN<T, N> *dirs,
+    T *dists,
+    const size_t n,
+    const int lanes) const
+{
+    std::vector<VectorN<T, N>> invs(std::max(lanes, 1));
+    std::vector<VectorN<bool, N>> negs(invs.size());
+    std::vector<char> hits(n, 0);
+
+    auto enter = [&] (size_t l, size_t q)
+    {
+        invs[l] = make_vector<T, N>(1) / dirs[q];
+        negs[l] = make_vector<T, N, bool>(dirs[q], [] (T x) { return x < 0; });
+    };
+
+    auto visit = [&] (size_t l, size_t q, index_type curr, std::vector<index_type> &stack)
     {
-        int curr = recursive.top(); recursive.pop();
         const auto &node = mNodes[curr]; // safe reference
 
-        if (is_intersecting(node.b, org, inv, dist, true))
+        if (!is_intersecting(aabb_cast<T>(node.b), orgs[q], invs[l], dists[q], true)) return;
+
+        if (is_leaf(node))
         {
-            if (is_leaf(node))
+            auto ib = offset(node);
+            auto ie = ib + length(node);
+            for (auto i = ib; i < ie; ++i)
+                if (collide(q, mPrimitives[i], orgs[q], dirs[q], dists[q]))
+                    hits[q] = 1;
+        }
+        else
+        {
+            const auto dim = longest_axis(node.b);
+
+            if (negs[l][dim])
             {
-                int ib = offset(node);
-                int ie = ib + length(node);
-                for (int i = ib; i < ie; ++i)
-                    if (collide(mPrimitives[i], org, dir, dist))
-                        hit = true;
+                stack.push_back(left_child(node));
+                stack.push_back(right_child(node));
             }
             else
             {
-                const auto dim = longest_axis(node.b);
-
-                if (neg[dim])
-                {
-                    recursive.push(left_child(node));
-                    recursive.push(right_child(node));
-                }
-                else
-                {
-                    recursive.push(right_child(node));
-                    recursive.push(left_child(node));
-                }
+                stack.push_back(right_child(node));
+                stack.push_back(left_child(node));
             }
         }
-    }
+    };
 
-    return hit;
+    interleave(n, lanes, enter, visit);
+
+    return static_cast<size_t>(std::count(hits.begin(), hits.end(), 1));
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class RangeQuery>
+inline size_t Bvh<Primitive, T, N, Node>::search_batch(
+    RangeQuery *queries,
+    const size_t n,
+    const int lanes) const
+{
+    std::vector<char> hits(n, 0);
+
+    auto enter = [] (size_t, size_t) {};
+
+    auto visit = [&] (size_t, size_t q, index_type curr, std::vector<index_type> &stack)
+    {
+        const auto &node = mNodes[curr]; // safe reference
+
+        if (!queries[q](aabb_cast<T>(node.b))) return;
+
+        if (is_leaf(node))
+        {
+            auto ib = offset(node);
+            auto ie = ib + length(node);
+            for (auto i = ib; i < ie; ++i)
+                if (queries[q](mPrimitives[i]))
+                    hits[q] = 1;
+        }
+        else
+        {
+            stack.push_back(right_child(node));
+            stack.push_back(left_child(node));
+        }
+    };
+
+    interleave(n, lanes, enter, visit);
+
+    return static_cast<size_t>(std::count(hits.begin(), hits.end(), 1));
 }
 
 ////////////////////////////////////////////////////////////////
@@ -407,7 +1480,10 @@ MiddlePointSplit<Primitive, PrimitiveBound, T, N>::operator()(
 }
 
 /// Split Method: SAH
-/// Partition primitives via surface area heuristic
+/// Partition primitives via surface area heuristic.
+/// If maxLeafSize is positive, nodes holding no more primitives than it
+/// are made leaves whenever intersecting all of them is cheaper than
+/// traversing down to the best split, which adapts leaf sizes to density.
 template<class Primitive, class PrimitiveBound, typename T, size_t N>
 struct SAHSplit
 {
@@ -418,6 +1494,9 @@ struct SAHSplit
         typename std::vector<Primitive>::iterator eiter) const;
     const PrimitiveBound &bound;
     int nBuckets { 16 };
+    int maxLeafSize { 0 };    // 0: always split, leave termination to threshold
+    T costTraversal { 1 };    // cost of visiting a node
+    T costIntersect { 1 };    // cost of testing a primitive
 };
 
 template<class Primitive, class PrimitiveBound, typename T, size_t N>
@@ -435,8 +1514,10 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
     // degenerated bbox, stop splitting
     if (!is_valid(cbox, true)) return biter;
 
-    std::vector<Aabb<T, N>> boxes(nBuckets, make_aabb<T, N>());
-    std::vector<int> counts(nBuckets, 0);
+    // scratch bins are released on return
+    ArenaScope scratch(scratch_arena());
+    Aabb<T, N> *boxes = scratch.allocate<Aabb<T, N>>(nBuckets, make_aabb<T, N>());
+    size_t *counts = scratch.allocate<size_t>(nBuckets, 0);
 
     for (auto iter = biter; iter != eiter; ++iter)
     {
@@ -447,28 +1528,29 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
         ++counts[b];
     }
 
+    // bounds of [b+1, nB-1] swept from the right, so that the
+    // sweep from the left is linear in the number of buckets
+    Aabb<T, N> *rboxes = scratch.allocate<Aabb<T, N>>(nBuckets, make_aabb<T, N>());
+    size_t *rcounts = scratch.allocate<size_t>(nBuckets, 0);
+
+    for (int b = nBuckets - 2; b >= 0; --b)
+    {
+        rboxes[b] = merge(rboxes[b + 1], boxes[b + 1]);
+        rcounts[b] = rcounts[b + 1] + counts[b + 1];
+    }
+
     // cost of splitting [0,b] and [b+1, nB-1]
     T minCost = std::numeric_limits<T>::max();
     int splitBucketId = 0;
+    Aabb<T, N> bbox0 = make_aabb<T, N>();
+    size_t count0{};
 
     for (int b = 0; b < nBuckets - 1; ++b)
     {
-        Aabb<T, N> bbox0 = make_aabb<T, N>(), bbox1 = make_aabb<T, N>();
-        int count0{}, count1{};
-
-        for (int i = 0; i <= b; ++i)
-        {
-            bbox0 = merge(bbox0, boxes[i]);
-            count0 += counts[i];
-        }
-
-        for (int i = b + 1; i < nBuckets; ++i)
-        {
-            bbox1 = merge(bbox1, boxes[i]);
-            count1 += counts[i];
-        }
+        bbox0 = merge(bbox0, boxes[b]);
+        count0 += counts[b];
 
-        T cost = area(bbox0) * count0 + area(bbox1) * count1;
+        T cost = area(bbox0) * (T)count0 + area(rboxes[b]) * (T)rcounts[b];
 
         // find bucket id that minimizes SAH metric
         if (minCost > cost)
@@ -478,6 +1560,12 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
         }
     }
 
+    // make a leaf if it is cheaper than the best split
+    const auto n = std::distance(biter, eiter);
+    if (n <= maxLeafSize &&
+        costIntersect * (T)n <= costTraversal + costIntersect * minCost / area(cbox))
+        return biter;
+
     // split according to the SAH result
     auto siter = std::partition(biter, eiter, [&](const Primitive &p)
     {
@@ -490,7 +1578,6 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
     // use EqualCount if split failed
     if (siter == biter || siter == eiter)
     {
-        const auto n = std::distance(biter, eiter);
         auto piter = biter + n / 2;
         std::nth_element(biter, piter, eiter, [&](const Primitive &a, const Primitive &b)
         { return centroid(bound(a))[dim] < centroid(bound(b))[dim]; });
@@ -500,6 +1587,215 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
     return siter;
 }
 
+////////////////////////////////////////////////////////////////
+/// Bvh build by index
+////////////////////////////////////////////////////////////////
+
+/// Bound of a primitive referred by its index. Boxes are evaluated
+/// once before building, so splitting never touches user data.
+template <typename T, size_t N>
+struct IndexBound
+{
+    IndexBound(const std::vector<Aabb<T, N>> &boxes): boxes(boxes) {}
+    inline const Aabb<T, N> &operator() (uint32_t i) const { return boxes[i]; }
+    const std::vector<Aabb<T, N>> &boxes;
+};
+
+/// Build a tree of 32-bit indices into the primitives, which are
+/// left untouched. Only the indices are moved around by splitting.
+/// Throws std::length_error if there are more than 2^32 primitives.
+template <template <class, class, typename, size_t> class PrimitiveSplit,
+    class Primitive, class PrimitiveBound, typename T, size_t N, class Node>
+inline void build_indexed(
+    Bvh<uint32_t, T, N, Node> &bvh,
+    const std::vector<Primitive> &primitives,
+    const PrimitiveBound &bound,
+    const int threshold = 1)
+{
+    if (primitives.size() > std::numeric_limits<uint32_t>::max())
+        throw std::length_error("build_indexed: more primitives than 32-bit indices");
+
+    std::vector<Aabb<T, N>> boxes;
+    boxes.reserve(primitives.size());
+    for (const auto &primitive : primitives)
+        boxes.push_back(bound(primitive));
+
+    std::vector<uint32_t> ids(primitives.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+        ids[i] = static_cast<uint32_t>(i);
+
+    IndexBound<T, N> ibound(boxes);
+    PrimitiveSplit<uint32_t, IndexBound<T, N>, T, N> split(ibound);
+    bvh.build(ids, ibound, split, threshold);
+}
+
+/// Reorder the primitives into the leaf order of the tree built by
+/// build_indexed, after which the tree refers to them in sequence.
+/// Primitives are moved in place along the cycles of the permutation.
+/// Throws std::invalid_argument if the tree is not over them.
+template <class Primitive, typename T, size_t N, class Node>
+inline void reorder(
+    Bvh<uint32_t, T, N, Node> &bvh,
+    std::vector<Primitive> &primitives)
+{
+    auto &ids = bvh.primitives();
+    const size_t n = ids.size();
+
+    if (primitives.size() != n)
+        throw std::invalid_argument("reorder: tree is not built over these primitives");
+    std::vector<bool> done(n, false);
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (done[i]) continue;
+
+        Primitive tmp = std::move(primitives[i]);
+        size_t j = i;
+
+        for (;;)
+        {
+            const size_t k = ids[j];
+            done[j] = true;
+            if (k == i) { primitives[j] = std::move(tmp); break; }
+            primitives[j] = std::move(primitives[k]);
+            j = k;
+        }
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        ids[i] = static_cast<uint32_t>(i);
+}
+
+////////////////////////////////////////////////////////////////
+/// Bvh reproducible build
+////////////////////////////////////////////////////////////////
+
+/// Key of a primitive which is an id itself, e.g. trees built by index.
+struct IdentityKey
+{
+    template <typename I>
+    inline uint64_t operator() (const I &id) const { return static_cast<uint64_t>(id); }
+};
+
+/// Split Method: Deterministic
+/// Sort primitives of the node by their unique keys before splitting,
+/// so that ties of nth_element and partition are broken by key rather
+/// than by incoming order. The tree is then the same for any ordering
+/// of the input, whichever thread or run produced it.
+template <class PrimitiveSplit, class PrimitiveKey = IdentityKey>
+struct DeterministicSplit
+{
+    DeterministicSplit(const PrimitiveSplit &split, const PrimitiveKey &key = PrimitiveKey()): split(split), key(key) {}
+
+    template <class Primitive>
+    inline typename std::vector<Primitive>::iterator operator() (
+        std::vector<Primitive> &primitives,
+        typename std::vector<Primitive>::iterator biter,
+        typename std::vector<Primitive>::iterator eiter) const
+    {
+        auto less = [&](const Primitive &a, const Primitive &b) { return key(a) < key(b); };
+        if (!std::is_sorted(biter, eiter, less)) std::sort(biter, eiter, less);
+        return split(primitives, biter, eiter);
+    }
+
+    const PrimitiveSplit &split;
+    PrimitiveKey key;
+};
+
+/// FNV-1a hash of the tree layout: node boxes, node indices and the keys
+/// of the primitives in leaf order. Equal hashes mean bit-identical trees.
+template <class Primitive, typename T, size_t N, class Node, class PrimitiveKey = IdentityKey>
+inline uint64_t tree_hash(
+    const Bvh<Primitive, T, N, Node> &bvh,
+    const PrimitiveKey &key = PrimitiveKey())
+{
+    uint64_t h = 14695981039346656037ull;
+    auto fold = [&h](const void *data, size_t size)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i) { h ^= bytes[i]; h *= 1099511628211ull; }
+    };
+
+    for (const auto &node : bvh.nodes())
+    {
+        for (int k = 0; k < 2; ++k) for (size_t d = 0; d < N; ++d)
+        {
+            typename Node::value_type x = node.b[k][d];
+            fold(&x, sizeof(x));
+        }
+        fold(&node.i0, sizeof(node.i0));
+        fold(&node.i1, sizeof(node.i1));
+    }
+
+    for (const auto &primitive : bvh.primitives())
+    {
+        uint64_t k = key(primitive);
+        fold(&k, sizeof(k));
+    }
+
+    return h;
+}
+
+////////////////////////////////////////////////////////////////
+/// Bvh report
+////////////////////////////////////////////////////////////////
+
+/// Shape of a built tree, to tune splitting on a given scene
+template <typename T>
+struct TreeReport
+{
+    size_t nodes {};
+    size_t leaves {};
+    size_t primitives {};
+    size_t depth {};          // depth of the deepest leaf
+    size_t largest {};        // #primitive of the largest leaf
+    T cost {};                // SAH cost of the tree, relative to the root area
+    std::vector<size_t> sizes; // sizes[k]: #leaf holding k primitives
+};
+
+template <class Primitive, typename T, size_t N, class Node>
+inline TreeReport<T> tree_report(
+    const Bvh<Primitive, T, N, Node> &bvh,
+    const T costTraversal = 1,
+    const T costIntersect = 1)
+{
+    typedef typename Node::index_type index_type;
+    TreeReport<T> report;
+    const auto &nodes = bvh.nodes();
+    if (nodes.empty()) return report;
+
+    const T rootArea = area(bvh.aabb());
+    std::stack<std::pair<index_type, size_t>> recursive({ { 0, 0 } });
+
+    while (!recursive.empty())
+    {
+        auto curr = recursive.top(); recursive.pop();
+        const auto &node = nodes[curr.first]; // safe reference
+        const T ratio = rootArea > 0 ? area(aabb_cast<T>(node.b)) / rootArea : (T)1;
+        ++report.nodes;
+
+        if (is_leaf(node))
+        {
+            const auto n = static_cast<size_t>(length(node));
+            if (report.sizes.size() <= n) report.sizes.resize(n + 1, 0);
+            ++report.sizes[n];
+            ++report.leaves;
+            report.primitives += n;
+            report.depth = std::max(report.depth, curr.second);
+            report.largest = std::max(report.largest, n);
+            report.cost += costIntersect * (T)n * ratio;
+        }
+        else
+        {
+            report.cost += costTraversal * ratio;
+            recursive.push({ right_child(node), curr.second + 1 });
+            recursive.push({ left_child(node), curr.second + 1 });
+        }
+    }
+
+    return report;
+}
+
 ////////////////////////////////////////////////////////////////
 /// Bvh definition example
 ////////////////////////////////////////////////////////////////
@@ -525,6 +1821,15 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
 /// Some built-in implementations are provided.
 /// 
 
+/// Key Program Interfaces:
+/// 
+/// struct PrimitiveKey
+/// {
+///     uint64_t operator() (const Primitive &primitive) const; // unique per primitive
+///     ...
+/// };
+/// 
+
 /// Query Program Interfaces:
 /// 
 /// struct RangeQuery
@@ -535,6 +1840,68 @@ SAHSplit<Primitive, PrimitiveBound, T, N>::operator()(
 /// };
 /// 
 
+/// Cull Program Interfaces:
+/// 
+/// struct PolytopeQuery
+/// {
+///     bool operator() (const Primitive &primitive, bool contained); // contained: box is inside the polytope
+///     ...
+/// };
+/// 
+
+/// Batch Collide Program Interfaces:
+/// 
+/// struct BatchCollide
+/// {
+///     bool operator() (size_t query, // index of the ray in the batch
+///                      const Primitive &primitive,
+///                      const VectorN<T, N> &org,
+///                      const VectorN<T, N> &dir,
+///                      T &dist);
+///     ...
+/// };
+/// 
+
+/// Leaf Collide Program Interfaces:
+/// 
+/// struct LeafCollide
+/// {
+///     bool operator() (index_type ib, index_type ie, // range of primitives in the leaf
+///                      const VectorN<T, N> &org,
+///                      const VectorN<T, N> &dir,
+///                      T &dist);
+///     ...
+/// };
+/// 
+
+/// Traverse Program Interfaces:
+/// 
+/// struct NodeTest
+/// {
+///     bool operator() (const Aabb<T, N> &box); // whether to enter the node
+///     ...
+/// };
+/// 
+/// struct LeafVisit
+/// {
+///     bool operator() (index_type ib, index_type ie); // primitives of the leaf, returns hit
+///     ...
+/// };
+/// 
+/// bvh.traverse<Order, Termination>(test, visit, stats);
+/// 
+
+/// Overlap Program Interfaces:
+/// 
+/// struct PrimitiveOverlap
+/// {
+///     bool operator() (const Primitive &a, const Other &b); // b is in its own frame
+///     ...
+/// };
+/// 
+/// The program is invoked concurrently if more than one thread is used.
+/// 
+
 /// Collide Program Interfaces:
 /// 
 /// struct PrimitiveCollide
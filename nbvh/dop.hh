@@ -0,0 +1,316 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_DOP_HH
+#define BVH_DOP_HH
+
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Discrete Oriented Polytope
+////////////////////////////////////////////////////////////////
+
+/// k-DOP bounded by D slabs along fixed directions (k = 2D faces).
+/// The first N directions are the coordinate axes, followed by
+/// the corner diagonals (1, +-1, ..., +-1), the edge diagonals
+/// e_i +- e_j, or both. In 3D, D = 3, 7, 9 and 13 give the AABB,
+/// 14-, 18- and 26-DOP. A DOP is a box in the space of projections
+/// on its directions, which is what most of its operations rely on.
+template <typename T, size_t N, size_t D>
+struct Dop
+{
+    static constexpr size_t nCorners = size_t(1) << (N - 1);
+    static constexpr size_t nEdges = N * (N - 1);
+    static_assert(D == N || D == N + nCorners || D == N + nEdges || D == N + nCorners + nEdges,
+        "directions are the axes, plus corner and/or edge diagonals");
+
+    typedef T value_type;
+    typedef VectorN<T, D> type;
+
+    inline const VectorN<T, D> &operator[](size_t i) const { return p[i]; }
+    inline VectorN<T, D> &operator[](size_t i) { return p[i]; }
+
+    VectorN<T, D> p[2]; // min, max of projections
+};
+
+template <typename T, size_t N, size_t D>
+struct DopAxes
+{
+    DopAxes()
+    {
+        typedef Dop<T, N, D> dop_type;
+        const bool corners = D == N + dop_type::nCorners || D == N + dop_type::nCorners + dop_type::nEdges;
+        const bool edges = D == N + dop_type::nEdges || D == N + dop_type::nCorners + dop_type::nEdges;
+        size_t k = 0;
+
+        for (size_t i = 0; i < N; ++i, ++k)
+        {
+            a[k] = make_vector<T, N>(0);
+            a[k][i] = 1;
+        }
+
+        if (corners) for (size_t m = 0; m < dop_type::nCorners; ++m, ++k)
+        {
+            a[k] = make_vector<T, N>(1);
+            for (size_t i = 1; i < N; ++i)
+                if (m & (size_t(1) << (i - 1))) a[k][i] = -1;
+        }
+
+        if (edges) for (size_t i = 0; i < N; ++i) for (size_t j = i + 1; j < N; ++j, k += 2)
+        {
+            a[k] = a[k + 1] = make_vector<T, N>(0);
+            a[k][i] = a[k + 1][i] = 1;
+            a[k][j] = 1; a[k + 1][j] = -1;
+        }
+    }
+
+    VectorN<T, N> a[D];
+};
+
+/// Directions of slabs, not normalized
+template <typename T, size_t N, size_t D>
+inline const DopAxes<T, N, D> &dop_axes()
+{
+    static const DopAxes<T, N, D> axes;
+    return axes;
+}
+
+/// Projections of a point (or a ray direction) on the directions
+template <typename T, size_t N, size_t D>
+inline VectorN<T, D> project(const VectorN<T, N> &v)
+{
+    const auto &axes = dop_axes<T, N, D>();
+    VectorN<T, D> s;
+    for (size_t k = 0; k < D; ++k) s[k] = dot(axes.a[k], v);
+    return s;
+}
+
+////////////////////////////////////////////////////////////////
+/// DOP impls
+////////////////////////////////////////////////////////////////
+
+template <typename T, size_t N, size_t D>
+inline Dop<T, N, D> make_dop()
+{ return { make_vector<T, D>(+std::numeric_limits<T>::max()), make_vector<T, D>(-std::numeric_limits<T>::max()) }; }
+
+template <typename T, size_t N, size_t D>
+inline Dop<T, N, D> make_dop(const VectorN<T, N> &v)
+{ const auto s = project<T, N, D>(v); return { s, s }; }
+
+template <typename T, size_t N, size_t D, typename... R>
+inline Dop<T, N, D> make_dop(const VectorN<T, N> &v, const VectorN<R, N> &... vs)
+{ return merge(make_dop<T, N, D>(v), make_dop<T, N, D>(vs...)); }
+
+template <typename T, size_t N, size_t D>
+inline Dop<T, N, D> merge(const Dop<T, N, D> &b_0, const Dop<T, N, D> &b_1)
+{ return { min(b_0[0], b_1[0]), max(b_0[1], b_1[1]) }; }
+
+/// Box made of the axis slabs
+template <typename T, size_t N, size_t D>
+inline Aabb<T, N> make_aabb(const Dop<T, N, D> &b)
+{ return { make_vector<T, N>(b[0]), make_vector<T, N>(b[1]) }; }
+
+/// DOPs overlap unless separated along one of their directions
+template <typename T, size_t N, size_t D>
+inline bool is_intersecting(const Dop<T, N, D> &b_0, const Dop<T, N, D> &b_1)
+{ return b_0[0] <= b_1[1] && b_1[0] <= b_0[1]; }
+
+/// Slab test of a ray given by the projections of its origin and
+/// the inverse projections of its direction
+template <typename T, size_t N, size_t D>
+inline bool is_intersecting(const Dop<T, N, D> &b, const VectorN<T, D> &org, const VectorN<T, D> &inv, const T &dist, bool _)
+{
+    const VectorN<T, D> k0 = (b[0] - org) * inv;
+    const VectorN<T, D> k1 = (b[1] - org) * inv;
+    const T t0 = max(min(k0, k1));
+    const T t1 = min(max(k0, k1));
+    return t1 > 0 && t1 >= t0 && dist > t0;
+}
+
+////////////////////////////////////////////////////////////////
+/// DOP Bvh
+////////////////////////////////////////////////////////////////
+
+/// Box of the axis slabs of a primitive's DOP, which is what
+/// the tree structure is built upon.
+template <class PrimitiveBound, typename T, size_t N>
+struct DopBoxBound
+{
+    DopBoxBound(const PrimitiveBound &bound): bound(bound) {}
+    template <class Primitive>
+    inline Aabb<T, N> operator() (const Primitive &primitive) const { return make_aabb(bound(primitive)); }
+    const PrimitiveBound &bound;
+};
+
+/// Bvh whose nodes are bounded by D-slab DOPs, kept aside the boxes
+/// of the underlying tree, to cut false positive visits on diagonal
+/// or rotated geometry at the cost of D - N more slabs per node test.
+/// Node is the node type of the tree as for Bvh, the DOPs are kept in T.
+template <class Primitive, typename T, size_t N, size_t D, class Node = BvhNode<T, N>>
+class DopBvh
+{
+public:
+    typedef T value_type;
+    typedef Dop<T, N, D> bound_type;
+    typedef Bvh<Primitive, T, N, Node> tree_type;
+    typedef typename Node::index_type index_type;
+
+public:
+    /// bound(primitive) is the DOP of primitive
+    template <template <class, class, typename, size_t> class PrimitiveSplit, class PrimitiveBound>
+    inline void build(
+        std::vector<Primitive> &primitives,
+        const PrimitiveBound &bound,
+        const int threshold = 1);
+
+    template <class PrimitiveCollide, class Stats>
+    inline bool intersect(
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        T &dist,
+        Stats &stats) const;
+
+    template <class PrimitiveCollide>
+    inline bool intersect(
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        T &dist) const
+    { NoStats stats; return intersect(collide, org, dir, dist, stats); }
+
+    /// query(dop) is the rough query, query(primitive) the fine one
+    template <class RangeQuery, class Stats>
+    inline bool search(
+        RangeQuery &query,
+        Stats &stats) const;
+
+    template <class RangeQuery>
+    inline bool search(RangeQuery &query) const
+    { NoStats stats; return search(query, stats); }
+
+    inline const Dop<T, N, D> &dop(size_t node) const { return mDops[node]; }
+    inline const tree_type &tree() const { return mTree; }
+    inline const std::vector<Primitive> &primitives() const { return mTree.primitives(); }
+    inline bool is_empty() const { return mTree.is_empty(); }
+
+protected:
+    tree_type mTree;                 // structure and boxes
+    std::vector<Dop<T, N, D>> mDops; // one per node
+};
+
+template <class Primitive, typename T, size_t N, size_t D, class Node>
+template <template <class, class, typename, size_t> class PrimitiveSplit, class PrimitiveBound>
+inline void DopBvh<Primitive, T, N, D, Node>::build(
+    std::vector<Primitive> &primitives,
+    const PrimitiveBound &bound,
+    const int threshold)
+{
+    DopBoxBound<PrimitiveBound, T, N> boxes(bound);
+    PrimitiveSplit<Primitive, decltype(boxes), T, N> split(boxes);
+    mTree.clear();
+    mTree.build(primitives, boxes, split, threshold);
+
+    const auto &nodes = mTree.nodes();
+    const auto &prims = mTree.primitives();
+    mDops.assign(nodes.size(), make_dop<T, N, D>());
+
+    // children are stored after their parent, refit bottom-up
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        const auto &node = nodes[i];
+
+        if (is_leaf(node))
+        {
+            auto ib = offset(node);
+            auto ie = ib + length(node);
+            for (auto j = ib; j < ie; ++j)
+                mDops[i] = merge(mDops[i], bound(prims[j]));
+        }
+        else
+        {
+            mDops[i] = merge(mDops[left_child(node)], mDops[right_child(node)]);
+        }
+    }
+}
+
+template <class Primitive, typename T, size_t N, size_t D, class Node>
+template <class PrimitiveCollide, class Stats>
+inline bool DopBvh<Primitive, T, N, D, Node>::intersect(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist,
+    Stats &stats) const
+{
+    const auto &prims = mTree.primitives();
+
+    // slabs of the DOP instead of the boxes of the tree, the ray is
+    // projected once onto the DOP axes
+    struct DopRayNodeTest : public RayNodeTest<T, N>
+    {
+        DopRayNodeTest(const DopBvh &bvh, const VectorN<T, N> &org, const VectorN<T, N> &dir, const T &dist):
+            RayNodeTest<T, N>(org, dir, dist), bvh(bvh),
+            sorg(project<T, N, D>(org)), sinv(make_vector<T, D>(1) / project<T, N, D>(dir)) {}
+        inline bool operator() (const Aabb<T, N> &, const index_type node) const
+        { return is_intersecting(bvh.dop(node), sorg, sinv, this->dist, true); }
+        const DopBvh &bvh;
+        VectorN<T, D> sorg;
+        VectorN<T, D> sinv;
+    } test(*this, org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (collide(prims[i], org, dir, dist))
+                hit = true;
+        return hit;
+    };
+
+    return mTree.template traverse<NearFirst, AllHits>(test, visit, stats);
+}
+
+template <class Primitive, typename T, size_t N, size_t D, class Node>
+template <class RangeQuery, class Stats>
+inline bool DopBvh<Primitive, T, N, D, Node>::search(
+    RangeQuery &query,
+    Stats &stats) const
+{
+    const auto &prims = mTree.primitives();
+
+    auto test = [&] (const Aabb<T, N> &, const index_type node) { return query(mDops[node]); };
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (query(prims[i]))
+                hit = true;
+        return hit;
+    };
+
+    return mTree.template traverse<DepthFirst, AllHits>(test, visit, stats);
+}
+
+#endif // !BVH_DOP_HH
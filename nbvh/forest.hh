@@ -0,0 +1,260 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_FOREST_HH
+#define BVH_FOREST_HH
+
+#include <atomic>
+#include <thread>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Bvh forest
+////////////////////////////////////////////////////////////////
+
+/// Many small trees built in one batch into pooled storage: all nodes
+/// live in one array and all primitives in another, and trees are
+/// handed out as views of their root. Trees are scheduled on worker
+/// threads started by each build, each building into its own tree
+/// whose memory is reused from one tree to the next.
+template <class Primitive, typename T, size_t N, class Node = BvhNode<T, N>>
+class BvhForest
+{
+public:
+    typedef T value_type;
+    typedef Bvh<Primitive, T, N, Node> tree_type;
+    typedef typename Node::index_type index_type;
+
+    /// Lightweight handle of one tree of the forest
+    class View
+    {
+    public:
+        View(const tree_type &pool, index_type root, index_type ib, index_type ie):
+            mPool(&pool), mRoot(root), mBegin(ib), mEnd(ie) {}
+
+        template <class PrimitiveCollide>
+        inline bool intersect(
+            PrimitiveCollide &collide,
+            const VectorN<T, N> &org,
+            const VectorN<T, N> &dir,
+            T &dist) const;
+
+        template <class PrimitiveCollide>
+        inline bool occluded(
+            PrimitiveCollide &collide,
+            const VectorN<T, N> &org,
+            const VectorN<T, N> &dir,
+            T &dist) const;
+
+        template <class RangeQuery>
+        inline bool search(RangeQuery &query) const;
+
+        inline const Primitive *begin() const { return mPool->primitives().data() + mBegin; }
+        inline const Primitive *end() const { return mPool->primitives().data() + mEnd; }
+        inline Aabb<T, N> aabb() const { return is_empty() ? make_aabb<T, N>() : aabb_cast<T>(mPool->nodes()[mRoot].b); }
+        inline bool is_empty() const { return mRoot < 0; }
+
+    protected:
+        const tree_type *mPool;
+        index_type mRoot;        // -1 if empty
+        index_type mBegin, mEnd; // primitives in the pool
+    };
+
+public:
+    /// Tree k is built over primitives [ranges[k], ranges[k + 1])
+    template <class PrimitiveBound, class PrimitiveSplit>
+    inline void build(
+        const std::vector<Primitive> &primitives,
+        const std::vector<size_t> &ranges,
+        const PrimitiveBound &bound,
+        const PrimitiveSplit &split,
+        const int threshold = 1,
+        const int threads = 1);
+
+    inline View tree(size_t k) const { return View(mPool, mRoots[k], mRanges[k], mRanges[k + 1]); }
+    inline size_t size() const { return mRoots.size(); }
+
+    inline const std::vector<Node> &nodes() const { return mPool.nodes(); }
+    inline const std::vector<Primitive> &primitives() const { return mPool.primitives(); }
+
+protected:
+    tree_type mPool;                  // nodes of all trees, never queried from node 0
+    std::vector<index_type> mRoots;   // per tree
+    std::vector<index_type> mRanges;  // per tree and one past the last
+};
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveBound, class PrimitiveSplit>
+inline void BvhForest<Primitive, T, N, Node>::build(
+    const std::vector<Primitive> &primitives,
+    const std::vector<size_t> &ranges,
+    const PrimitiveBound &bound,
+    const PrimitiveSplit &split,
+    const int threshold,
+    const int threads)
+{
+    const size_t k = ranges.empty() ? 0 : ranges.size() - 1;
+    const int nWorkers = std::max(threads, 1);
+    auto &nodes = mPool.nodes();
+    auto &prims = mPool.primitives();
+
+    prims.assign(primitives.begin(), primitives.end());
+    mRoots.assign(k, -1);
+    mRanges.assign(ranges.begin(), ranges.end());
+
+    // every worker appends the nodes of its trees to its own buffer,
+    // buffers are joined in tree order afterwards
+    std::vector<std::vector<Node>> buffers(nWorkers);
+    std::vector<int> owners(k, 0);
+    std::vector<size_t> starts(k, 0), counts(k, 0);
+    std::atomic<size_t> next { 0 };
+
+    auto work = [&] (int w)
+    {
+        tree_type tree; // memory is kept from one tree to the next
+        auto &buffer = buffers[w];
+
+        for (size_t i = next++; i < k; i = next++)
+        {
+            const auto ib = static_cast<index_type>(ranges[i]);
+            const auto ie = static_cast<index_type>(ranges[i + 1]);
+            if (ib == ie) continue;
+
+            tree.clear();
+            tree.build(prims.begin() + ib, prims.begin() + ie, bound, split, threshold);
+            std::copy(tree.primitives().begin(), tree.primitives().end(), prims.begin() + ib);
+
+            owners[i] = w;
+            starts[i] = buffer.size();
+            counts[i] = tree.nodes().size();
+            buffer.insert(buffer.end(), tree.nodes().begin(), tree.nodes().end());
+        }
+    };
+
+    if (nWorkers == 1) work(0);
+    else
+    {
+        std::vector<std::thread> workers;
+        for (int t = 0; t < nWorkers; ++t) workers.emplace_back(work, t);
+        for (auto &worker : workers) worker.join();
+    }
+
+    // into the pool, indices are shifted to where each tree lands
+    size_t total = 0;
+    for (const auto &buffer : buffers) total += buffer.size();
+    nodes.resize(total);
+
+    size_t cursor = 0;
+    for (size_t i = 0; i < k; ++i)
+    {
+        if (counts[i] == 0) continue;
+
+        const auto ib = static_cast<index_type>(ranges[i]);
+        const auto no = static_cast<index_type>(cursor);
+        const auto &buffer = buffers[owners[i]];
+        for (size_t j = 0; j < counts[i]; ++j)
+        {
+            auto node = buffer[starts[i] + j];
+            if (is_leaf(node)) offset(node) += ib;
+            else { left_child(node) += no; right_child(node) += no; }
+            nodes[cursor + j] = node;
+        }
+
+        mRoots[i] = no;
+        cursor += counts[i];
+    }
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveCollide>
+inline bool BvhForest<Primitive, T, N, Node>::View::intersect(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist) const
+{
+    if (is_empty()) return false;
+
+    const auto &prims = mPool->primitives();
+    RayNodeTest<T, N> test(org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (collide(prims[i], org, dir, dist))
+                hit = true;
+        return hit;
+    };
+
+    NoStats stats;
+    return mPool->template traverse<NearFirst, AllHits>(test, visit, stats, mRoot);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class PrimitiveCollide>
+inline bool BvhForest<Primitive, T, N, Node>::View::occluded(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist) const
+{
+    if (is_empty()) return false;
+
+    const auto &prims = mPool->primitives();
+    RayNodeTest<T, N> test(org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        for (auto i = ib; i < ie; ++i)
+            if (collide(prims[i], org, dir, dist))
+                return true;
+        return false;
+    };
+
+    NoStats stats;
+    return mPool->template traverse<DepthFirst, AnyHit>(test, visit, stats, mRoot);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class RangeQuery>
+inline bool BvhForest<Primitive, T, N, Node>::View::search(RangeQuery &query) const
+{
+    if (is_empty()) return false;
+
+    const auto &prims = mPool->primitives();
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (query(prims[i]))
+                hit = true;
+        return hit;
+    };
+
+    NoStats stats;
+    return mPool->template traverse<DepthFirst, AllHits>(query, visit, stats, mRoot);
+}
+
+#endif // !BVH_FOREST_HH
@@ -0,0 +1,235 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_GRID_HH
+#define BVH_GRID_HH
+
+#include <unordered_map>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Entry grid
+////////////////////////////////////////////////////////////////
+
+/// Uniform grid over a built Bvh, whose cells point to the deepest node
+/// holding every primitive that overlaps the cell, i.e. the node where
+/// the paths to all leaves overlapping the cell part. Queries enclosed by
+/// a cell start there instead of localizing from the root. Cells of no
+/// primitive are kept as -1, or left out of the hashed grid, which only
+/// stores cells of primitives and suits sparse data.
+/// The tree must outlive and not change after build.
+template <class Primitive, typename T, size_t N, class Node = BvhNode<T, N>>
+class EntryGrid
+{
+public:
+    typedef T value_type;
+    typedef Bvh<Primitive, T, N, Node> tree_type;
+    typedef typename Node::index_type index_type;
+
+public:
+    inline EntryGrid(const tree_type &bvh, const size_t resolution, const bool hashed = false);
+
+    /// Node to start from for queries enclosed by region,
+    /// -1 if there is nothing, root if region spans cells
+    inline index_type entry(const Aabb<T, N> &region) const;
+
+    /// query(box), query(primitive) as Bvh::search, region encloses the query
+    template <class RangeQuery, class Stats>
+    inline bool search(RangeQuery &query, const Aabb<T, N> &region, Stats &stats) const;
+
+    template <class RangeQuery>
+    inline bool search(RangeQuery &query, const Aabb<T, N> &region) const
+    { NoStats stats; return search(query, region, stats); }
+
+    /// Bytes taken by cells
+    inline size_t memory() const;
+
+protected:
+    inline size_t cell(const VectorN<size_t, N> &c) const;
+    inline VectorN<size_t, N> coordinates(const VectorN<T, N> &v) const;
+    inline index_type locate(const Aabb<T, N> &cbox) const;
+
+protected:
+    const tree_type &mBvh;
+    Aabb<T, N> mBox;
+    VectorN<T, N> mSize;                                    // of a cell
+    size_t mResolution;                                     // cells per axis
+    bool mHashed;
+    std::vector<index_type> mCells;                         // dense
+    std::unordered_map<size_t, index_type> mHashedCells;    // hashed
+};
+
+template <class Primitive, typename T, size_t N, class Node>
+inline EntryGrid<Primitive, T, N, Node>::EntryGrid(
+    const tree_type &bvh,
+    const size_t resolution,
+    const bool hashed):
+    mBvh(bvh), mBox(bvh.aabb()), mResolution(std::max(resolution, size_t(1))), mHashed(hashed)
+{
+    mSize = diagonal(mBox) / (T)mResolution;
+    if (bvh.is_empty()) return;
+
+    size_t nCells = 1;
+    for (size_t i = 0; i < N; ++i) nCells *= mResolution;
+    if (!mHashed) mCells.assign(nCells, -1);
+
+    // points binned into a cell by coordinates() may lie past its faces
+    // by rounding, so cell boxes are padded outward to still enclose them
+    VectorN<T, N> pad;
+    for (size_t i = 0; i < N; ++i)
+        pad[i] = (std::abs(mBox[0][i]) + std::abs(mBox[1][i])) * std::numeric_limits<T>::epsilon() * (T)2;
+
+    // only cells overlapped by leaves may hold primitives
+    std::vector<char> seen(mHashed ? 0 : nCells, 0);
+    for (const auto &node : bvh.nodes())
+    {
+        if (!is_leaf(node)) continue;
+
+        const auto box = aabb_cast<T>(node.b);
+        const auto lo = coordinates(box[0]);
+        const auto hi = coordinates(box[1]);
+        auto c = lo;
+
+        for (;;)
+        {
+            const size_t k = cell(c);
+            const bool fresh = mHashed ? mHashedCells.count(k) == 0 : !seen[k];
+
+            if (fresh)
+            {
+                Aabb<T, N> cbox;
+                for (size_t i = 0; i < N; ++i)
+                {
+                    cbox[0][i] = mBox[0][i] + mSize[i] * (T)c[i] - pad[i];
+                    cbox[1][i] = mBox[0][i] + mSize[i] * (T)(c[i] + 1) + pad[i];
+                }
+
+                const auto e = locate(cbox);
+                if (mHashed) mHashedCells[k] = e;
+                else { mCells[k] = e; seen[k] = 1; }
+            }
+
+            // next cell of the range [lo, hi]
+            size_t i = 0;
+            for (; i < N; ++i)
+            {
+                if (c[i] < hi[i]) { ++c[i]; break; }
+                c[i] = lo[i];
+            }
+            if (i == N) break;
+        }
+    }
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline size_t EntryGrid<Primitive, T, N, Node>::cell(const VectorN<size_t, N> &c) const
+{
+    size_t k = 0;
+    for (size_t i = N; i-- > 0;) k = k * mResolution + c[i];
+    return k;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline VectorN<size_t, N> EntryGrid<Primitive, T, N, Node>::coordinates(const VectorN<T, N> &v) const
+{
+    VectorN<size_t, N> c;
+    for (size_t i = 0; i < N; ++i)
+    {
+        const T x = mSize[i] > 0 ? (v[i] - mBox[0][i]) / mSize[i] : (T)0;
+        c[i] = x <= 0 ? 0 : std::min(static_cast<size_t>(x), mResolution - 1);
+    }
+    return c;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline typename EntryGrid<Primitive, T, N, Node>::index_type
+EntryGrid<Primitive, T, N, Node>::locate(const Aabb<T, N> &cbox) const
+{
+    const auto &nodes = mBvh.nodes();
+    index_type curr = 0;
+
+    while (!is_leaf(nodes[curr]))
+    {
+        const auto &node = nodes[curr]; // safe reference
+        const bool l = is_intersecting(aabb_cast<T>(nodes[left_child(node)].b), cbox);
+        const bool r = is_intersecting(aabb_cast<T>(nodes[right_child(node)].b), cbox);
+        if (l && r) return curr;
+        if (!l && !r) return -1;
+        curr = l ? left_child(node) : right_child(node);
+    }
+
+    return is_intersecting(aabb_cast<T>(nodes[curr].b), cbox) ? curr : -1;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline typename EntryGrid<Primitive, T, N, Node>::index_type
+EntryGrid<Primitive, T, N, Node>::entry(const Aabb<T, N> &region) const
+{
+    if (mBvh.is_empty() || !is_intersecting(mBox, region)) return -1;
+
+    const auto lo = coordinates(region[0]);
+    const auto hi = coordinates(region[1]);
+    for (size_t i = 0; i < N; ++i)
+        if (lo[i] != hi[i]) return 0;
+
+    const size_t k = cell(lo);
+    if (!mHashed) return mCells[k];
+
+    auto iter = mHashedCells.find(k);
+    return iter != mHashedCells.end() ? iter->second : -1;
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class RangeQuery, class Stats>
+inline bool EntryGrid<Primitive, T, N, Node>::search(
+    RangeQuery &query,
+    const Aabb<T, N> &region,
+    Stats &stats) const
+{
+    const auto root = entry(region);
+    if (root < 0) return false;
+
+    const auto &prims = mBvh.primitives();
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (query(prims[i]))
+                hit = true;
+        return hit;
+    };
+
+    return mBvh.template traverse<DepthFirst, AllHits>(query, visit, stats, root);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+inline size_t EntryGrid<Primitive, T, N, Node>::memory() const
+{
+    if (!mHashed) return mCells.capacity() * sizeof(index_type);
+    // buckets plus nodes of key, value and next pointer
+    return mHashedCells.bucket_count() * sizeof(void*) +
+        mHashedCells.size() * (sizeof(size_t) + sizeof(index_type) + sizeof(void*));
+}
+
+#endif // !BVH_GRID_HH
@@ -0,0 +1,391 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_HIGHDIM_HH
+#define BVH_HIGHDIM_HH
+
+#include <queue>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Kernels
+////////////////////////////////////////////////////////////////
+
+/// Squared distance of two N-dimensional rows. Plain loops over
+/// L independent sums instead of VectorN folds, which the compiler
+/// vectorizes without reassociating and which does not unroll
+/// into N expressions per call site.
+template <size_t N, typename T>
+inline T sqr_distance_n(const T *a, const T *b)
+{
+    constexpr size_t L = 8;
+    constexpr size_t B = N / L * L;
+    T acc[L] {};
+
+    for (size_t d = 0; d < B; d += L)
+    {
+        for (size_t k = 0; k < L; ++k)
+        {
+            const T t = a[d + k] - b[d + k];
+            acc[k] += t * t;
+        }
+    }
+
+    T sum { 0 };
+    for (size_t d = B; d < N; ++d)
+        sum += (a[d] - b[d]) * (a[d] - b[d]);
+    for (size_t k = 0; k < L; ++k)
+        sum += acc[k];
+
+    return sum;
+}
+
+////////////////////////////////////////////////////////////////
+/// High-dimensional Bvh
+////////////////////////////////////////////////////////////////
+
+/// Bvh over points of many dimensions, e.g. feature vectors for
+/// nearest neighbor search, N from 16 to a few hundreds.
+/// Every node keeps its box only over the M dimensions in which
+/// it is the narrowest relative to the whole set, so a node costs
+/// as much as in a M-dimensional tree. The distance to this partial
+/// box is still a lower bound of the distance to any point below
+/// the node, and nearest searches carry the bound of the parent.
+/// Nodes are split at the median of the dimension of largest
+/// variance, and points are copied row by row in leaf order.
+/// I is the signed index type of nodes (see BvhNode), point ids
+/// are of its unsigned counterpart.
+template <typename T, size_t N, size_t M = 8, typename I = int>
+class HighDimBvh
+{
+    static_assert(M > 0 && M <= N, "bound dimensions must be a subset of the dimensions");
+    static_assert(N <= 65536, "dimensions are stored as 16-bit numbers");
+
+public:
+    typedef T value_type;
+    typedef I index_type;
+    typedef typename std::make_unsigned<I>::type id_type;
+    typedef BvhNode<T, M, I> node_type;
+    typedef std::array<uint16_t, M> dims_type;
+
+public:
+    /// Point i is at coords[i * stride + (0..N-1)]
+    inline void build(
+        const T *coords,
+        const size_t n,
+        const int threshold = 16,
+        const size_t stride = N);
+
+    /// query(id, sqr_dist) is called on every point within radius
+    template <class PointQuery>
+    inline bool radius_search(
+        PointQuery &query,
+        const T *center,
+        const T radius) const;
+
+    /// k nearest points as (sqr_dist, id), nearest first
+    inline size_t knn(
+        std::vector<std::pair<T, id_type>> &result,
+        const T *point,
+        const size_t k) const;
+
+    inline const std::vector<node_type> &nodes() const { return mNodes; }
+    inline const dims_type &dims(size_t node) const { return mDims[node]; }
+    inline const std::vector<id_type> &ids() const { return mIds; }
+    inline const T *coords(size_t i) const { return &mCoords[i * N]; }
+
+    inline bool is_empty() const { return mNodes.empty(); }
+    inline size_t size() const { return mIds.size(); }
+
+    /// bytes held by nodes and their dimensions
+    inline size_t memory() const { return mNodes.size() * (sizeof(node_type) + sizeof(dims_type)); }
+
+protected:
+    inline void recursive_build(
+        const T *coords,
+        const size_t stride,
+        const I ib,
+        const I ie,
+        const I curr,
+        const int threshold);
+
+    // squared distance of point p to the partial box of a node
+    inline T sqr_distance(const I node, const T *p) const;
+
+protected:
+    std::vector<node_type> mNodes; // boxes over the dimensions in mDims
+    std::vector<dims_type> mDims;
+    std::vector<T> mCoords; // leaf order, N per point
+    std::vector<id_type> mIds; // leaf order
+
+    // per-dimension scratch of the build
+    std::vector<T> mLower, mUpper, mMean, mVar;
+    std::vector<T> mExtent, mScore; // extent of the root, relative extent
+    std::vector<uint16_t> mOrder;
+};
+
+template <typename T, size_t N, size_t M, typename I>
+inline void HighDimBvh<T, N, M, I>::recursive_build(
+    const T *coords,
+    const size_t stride,
+    const I ib,
+    const I ie,
+    const I curr,
+    const int threshold)
+{
+    std::fill(mLower.begin(), mLower.end(), std::numeric_limits<T>::max());
+    std::fill(mUpper.begin(), mUpper.end(), std::numeric_limits<T>::lowest());
+    std::fill(mMean.begin(), mMean.end(), (T)0);
+    std::fill(mVar.begin(), mVar.end(), (T)0);
+
+    for (I i = ib; i < ie; ++i)
+    {
+        const T *p = coords + mIds[i] * stride;
+        for (size_t d = 0; d < N; ++d)
+        {
+            mLower[d] = std::min(mLower[d], p[d]);
+            mUpper[d] = std::max(mUpper[d], p[d]);
+            mMean[d] += p[d];
+        }
+    }
+
+    const T inv = (T)1 / (T)(ie - ib);
+    for (size_t d = 0; d < N; ++d)
+        mMean[d] *= inv;
+
+    for (I i = ib; i < ie; ++i)
+    {
+        const T *p = coords + mIds[i] * stride;
+        for (size_t d = 0; d < N; ++d)
+            mVar[d] += (p[d] - mMean[d]) * (p[d] - mMean[d]);
+    }
+
+    if (curr == 0)
+    {
+        for (size_t d = 0; d < N; ++d)
+            mExtent[d] = mUpper[d] - mLower[d];
+    }
+
+    // keep the box over the dimensions in which the node is the
+    // narrowest compared with the root, as these cut off most of
+    // the space; the parent box bounds the other ones
+    for (size_t d = 0; d < N; ++d)
+    {
+        mOrder[d] = static_cast<uint16_t>(d);
+        mScore[d] = mExtent[d] > 0 ? (mUpper[d] - mLower[d]) / mExtent[d] : (T)0;
+    }
+
+    std::partial_sort(mOrder.begin(), mOrder.begin() + M, mOrder.end(), [&](uint16_t a, uint16_t b)
+    { return mScore[a] < mScore[b]; });
+
+    for (size_t j = 0; j < M; ++j)
+    {
+        mDims[curr][j] = mOrder[j];
+        mNodes[curr].b[0][j] = mLower[mOrder[j]];
+        mNodes[curr].b[1][j] = mUpper[mOrder[j]];
+    }
+
+    const size_t dim = std::max_element(mVar.begin(), mVar.end()) - mVar.begin();
+
+    // make leaf if few points left or all points coincide
+    if (ie - ib <= threshold || !(mLower[dim] < mUpper[dim]))
+    {
+        set_leaf(mNodes[curr], ib, ie - ib);
+        return;
+    }
+
+    const I im = ib + (ie - ib) / 2;
+
+    std::nth_element(mIds.begin() + ib, mIds.begin() + im, mIds.begin() + ie, [&](id_type a, id_type b)
+    { return coords[a * stride + dim] < coords[b * stride + dim]; });
+
+    I left = static_cast<I>(mNodes.size());
+    left_child(mNodes[curr]) = left;
+    mNodes.emplace_back();
+    mDims.emplace_back();
+    recursive_build(coords, stride, ib, im, left, threshold);
+
+    I right = static_cast<I>(mNodes.size());
+    right_child(mNodes[curr]) = right;
+    mNodes.emplace_back();
+    mDims.emplace_back();
+    recursive_build(coords, stride, im, ie, right, threshold);
+}
+
+template <typename T, size_t N, size_t M, typename I>
+inline void HighDimBvh<T, N, M, I>::build(
+    const T *coords,
+    const size_t n,
+    const int threshold,
+    const size_t stride)
+{
+    mNodes.clear();
+    mDims.clear();
+    mIds.resize(n);
+    mCoords.clear();
+    if (n == 0) return;
+
+    for (size_t i = 0; i < n; ++i)
+        mIds[i] = static_cast<id_type>(i);
+
+    mLower.resize(N); mUpper.resize(N);
+    mMean.resize(N); mVar.resize(N);
+    mExtent.resize(N); mScore.resize(N);
+    mOrder.resize(N);
+
+    const size_t reserved = 2 * (n / std::max(threshold / 2, 1)) + 1;
+    mNodes.reserve(reserved);
+    mDims.reserve(reserved);
+    mNodes.emplace_back();
+    mDims.emplace_back();
+    recursive_build(coords, stride, 0, static_cast<I>(n), 0, std::max(threshold, 1));
+
+    mCoords.resize(n * N);
+    for (size_t i = 0; i < n; ++i)
+        std::copy(coords + mIds[i] * stride, coords + mIds[i] * stride + N, &mCoords[i * N]);
+}
+
+template <typename T, size_t N, size_t M, typename I>
+inline T HighDimBvh<T, N, M, I>::sqr_distance(const I node, const T *p) const
+{
+    const auto &b = mNodes[node].b;
+    const auto &dims = mDims[node];
+
+    T d2 { 0 };
+    for (size_t j = 0; j < M; ++j)
+    {
+        const T x = p[dims[j]];
+        const T t = std::max(std::max(b[0][j] - x, x - b[1][j]), (T)0);
+        d2 += t * t;
+    }
+
+    return d2;
+}
+
+template <typename T, size_t N, size_t M, typename I>
+template <class PointQuery>
+inline bool HighDimBvh<T, N, M, I>::radius_search(
+    PointQuery &query,
+    const T *center,
+    const T radius) const
+{
+    if (mNodes.empty()) return false;
+
+    const T r2 = radius * radius;
+
+    bool hit { false };
+    std::stack<I> recursive({ 0 });
+
+    while (!recursive.empty())
+    {
+        I curr = recursive.top(); recursive.pop();
+        const auto &node = mNodes[curr]; // safe reference
+
+        if (sqr_distance(curr, center) > r2) continue;
+
+        if (is_leaf(node))
+        {
+            I ib = offset(node);
+            I ie = ib + length(node);
+
+            for (I i = ib; i < ie; ++i)
+            {
+                const T d2 = sqr_distance_n<N>(&mCoords[i * N], center);
+                if (d2 <= r2)
+                {
+                    query(mIds[i], d2);
+                    hit = true;
+                }
+            }
+        }
+        else
+        {
+            recursive.push(right_child(node));
+            recursive.push(left_child(node));
+        }
+    }
+
+    return hit;
+}
+
+template <typename T, size_t N, size_t M, typename I>
+inline size_t HighDimBvh<T, N, M, I>::knn(
+    std::vector<std::pair<T, id_type>> &result,
+    const T *point,
+    const size_t k) const
+{
+    result.clear();
+    if (mNodes.empty() || k == 0) return 0;
+
+    // nodes visited nearest first, result kept as a max-heap
+    typedef std::pair<T, I> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    queue.emplace(sqr_distance(0, point), 0);
+
+    while (!queue.empty())
+    {
+        const auto curr = queue.top(); queue.pop();
+
+        if (result.size() == k && curr.first >= result.front().first) break;
+
+        const auto &node = mNodes[curr.second]; // safe reference
+
+        if (is_leaf(node))
+        {
+            I ib = offset(node);
+            I ie = ib + length(node);
+
+            for (I i = ib; i < ie; ++i)
+            {
+                const T d2 = sqr_distance_n<N>(&mCoords[i * N], point);
+
+                if (result.size() < k)
+                {
+                    result.emplace_back(d2, mIds[i]);
+                    std::push_heap(result.begin(), result.end());
+                }
+                else if (d2 < result.front().first)
+                {
+                    std::pop_heap(result.begin(), result.end());
+                    result.back() = { d2, mIds[i] };
+                    std::push_heap(result.begin(), result.end());
+                }
+            }
+        }
+        else
+        {
+            // children are also bounded by the dimensions of their parent
+            queue.emplace(std::max(curr.first, sqr_distance(left_child(node), point)), left_child(node));
+            queue.emplace(std::max(curr.first, sqr_distance(right_child(node), point)), right_child(node));
+        }
+    }
+
+    std::sort_heap(result.begin(), result.end());
+    return result.size();
+}
+
+#endif // !BVH_HIGHDIM_HH
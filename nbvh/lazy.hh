@@ -0,0 +1,191 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_LAZY_HH
+#define BVH_LAZY_HH
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Lazy Bvh
+////////////////////////////////////////////////////////////////
+
+/// Bvh whose top levels are built eagerly, while every leaf of the
+/// top tree holding more primitives than the threshold is expanded
+/// into a subtree the first time a query reaches it. Expansion is
+/// done once under std::call_once, so concurrent readers may query
+/// the same tree; the ones reaching a subtree being built wait for it.
+/// Bound and split are kept by reference to build subtrees later.
+template <class Primitive, typename T, size_t N, class PrimitiveBound, class PrimitiveSplit, class Node = BvhNode<T, N>>
+class LazyBvh
+{
+public:
+    typedef T value_type;
+    typedef Bvh<Primitive, T, N, Node> tree_type;
+    typedef typename Node::index_type index_type;
+
+public:
+    LazyBvh(const PrimitiveBound &bound, const PrimitiveSplit &split): bound(bound), split(split) {}
+
+    /// Split only down to eager_depth, deeper levels are deferred
+    inline void build(
+        std::vector<Primitive> &primitives,
+        const int threshold = 1,
+        const int eager_depth = 8);
+
+    template <class PrimitiveCollide>
+    inline bool intersect(
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        T &dist) const;
+
+    template <class RangeQuery>
+    inline bool search(RangeQuery &query) const;
+
+    /// Build all deferred subtrees now
+    inline void expand_all() const;
+
+    inline const tree_type &top() const { return mTop; }
+    inline size_t deferred() const { return mOffsets.size(); }
+    inline size_t expanded() const { return mExpanded.load(); }
+    inline Aabb<T, N> aabb() const { return mTop.aabb(); }
+    inline bool is_empty() const { return mTop.is_empty(); }
+
+protected:
+    struct Subtree
+    {
+        std::once_flag once;
+        tree_type tree;
+    };
+
+    inline const tree_type &subtree(index_type ib, index_type ie) const;
+
+protected:
+    const PrimitiveBound &bound;
+    const PrimitiveSplit &split;
+    int mThreshold { 1 };
+    tree_type mTop;                       // top levels, deferred leaves hold whole ranges
+    std::vector<index_type> mOffsets;     // first primitive of every deferred leaf, ascending
+    std::unique_ptr<Subtree[]> mSubtrees; // one per deferred leaf
+    mutable std::atomic<size_t> mExpanded { 0 };
+};
+
+template <class Primitive, typename T, size_t N, class PrimitiveBound, class PrimitiveSplit, class Node>
+inline void LazyBvh<Primitive, T, N, PrimitiveBound, PrimitiveSplit, Node>::build(
+    std::vector<Primitive> &primitives,
+    const int threshold,
+    const int eager_depth)
+{
+    mThreshold = std::max(threshold, 1);
+    mTop.clear();
+    mTop.build(primitives, bound, split, mThreshold, eager_depth);
+
+    // leaves are met in ascending order of their ranges, since
+    // children are appended depth-first with the left one first
+    mOffsets.clear();
+    for (const auto &node : mTop.nodes())
+        if (is_leaf(node) && length(node) > mThreshold)
+            mOffsets.push_back(offset(node));
+
+    mSubtrees.reset(new Subtree[mOffsets.size()]);
+    mExpanded = 0;
+}
+
+template <class Primitive, typename T, size_t N, class PrimitiveBound, class PrimitiveSplit, class Node>
+inline const typename LazyBvh<Primitive, T, N, PrimitiveBound, PrimitiveSplit, Node>::tree_type &
+LazyBvh<Primitive, T, N, PrimitiveBound, PrimitiveSplit, Node>::subtree(index_type ib, index_type ie) const
+{
+    const auto k = std::lower_bound(mOffsets.begin(), mOffsets.end(), ib) - mOffsets.begin();
+    Subtree &sub = mSubtrees[k];
+
+    std::call_once(sub.once, [&]
+    {
+        // primitives are copied, the top tree is left intact for other readers
+        const auto &prims = mTop.primitives();
+        std::vector<Primitive> range(prims.begin() + ib, prims.begin() + ie);
+        sub.tree.build(range, bound, split, mThreshold);
+        ++mExpanded;
+    });
+
+    return sub.tree;
+}
+
+template <class Primitive, typename T, size_t N, class PrimitiveBound, class PrimitiveSplit, class Node>
+template <class PrimitiveCollide>
+inline bool LazyBvh<Primitive, T, N, PrimitiveBound, PrimitiveSplit, Node>::intersect(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    T &dist) const
+{
+    const auto &prims = mTop.primitives();
+
+    auto visit = [&] (index_type ib, index_type ie, const VectorN<T, N> &org, const VectorN<T, N> &dir, T &dist)
+    {
+        if (ie - ib > mThreshold)
+            return subtree(ib, ie).intersect(collide, org, dir, dist);
+
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (collide(prims[i], org, dir, dist))
+                hit = true;
+        return hit;
+    };
+
+    return mTop.intersect_leaves(visit, org, dir, dist);
+}
+
+template <class Primitive, typename T, size_t N, class PrimitiveBound, class PrimitiveSplit, class Node>
+template <class RangeQuery>
+inline bool LazyBvh<Primitive, T, N, PrimitiveBound, PrimitiveSplit, Node>::search(RangeQuery &query) const
+{
+    const auto &prims = mTop.primitives();
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        if (ie - ib > mThreshold)
+            return subtree(ib, ie).search(query);
+
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (query(prims[i]))
+                hit = true;
+        return hit;
+    };
+
+    return mTop.template traverse<DepthFirst, AllHits>(query, visit);
+}
+
+template <class Primitive, typename T, size_t N, class PrimitiveBound, class PrimitiveSplit, class Node>
+inline void LazyBvh<Primitive, T, N, PrimitiveBound, PrimitiveSplit, Node>::expand_all() const
+{
+    for (const auto &node : mTop.nodes())
+        if (is_leaf(node) && length(node) > mThreshold)
+            subtree(offset(node), offset(node) + length(node));
+}
+
+#endif // !BVH_LAZY_HH
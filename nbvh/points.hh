@@ -0,0 +1,295 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_POINTS_HH
+#define BVH_POINTS_HH
+
+#include <queue>
+#include <functional>
+#include <type_traits>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Point Bvh
+////////////////////////////////////////////////////////////////
+
+/// Bvh specialized for point clouds. Points are built directly
+/// from a raw coordinate buffer and copied into the leaf order,
+/// one array per dimension, so leaves are scanned W points at
+/// a time without bound functors or index lookups.
+/// I is the signed index type of nodes (see BvhNode), point ids
+/// are of its unsigned counterpart.
+template <typename T, size_t N, typename I = int, int W = 8>
+class PointBvh
+{
+public:
+    typedef T value_type;
+    typedef I index_type;
+    typedef typename std::make_unsigned<I>::type id_type;
+    static constexpr int width = W;
+
+public:
+    /// Point i is at coords[i * stride + (0..N-1)]
+    inline void build(
+        const T *coords,
+        const size_t n,
+        const int threshold = 16,
+        const size_t stride = N);
+
+    /// query(id, sqr_dist) is called on every point within radius
+    template <class PointQuery>
+    inline bool radius_search(
+        PointQuery &query,
+        const VectorN<T, N> &center,
+        const T radius) const;
+
+    /// k nearest points as (sqr_dist, id), nearest first
+    inline size_t knn(
+        std::vector<std::pair<T, id_type>> &result,
+        const VectorN<T, N> &point,
+        const size_t k) const;
+
+    inline const std::vector<BvhNode<T, N, I>> &nodes() const { return mNodes; }
+    inline const std::vector<id_type> &ids() const { return mIds; }
+    inline const std::vector<T> &coords(size_t dim) const { return mCoords[dim]; }
+
+    inline Aabb<T, N> aabb() const { return mNodes.size() > 0 ? mNodes[0].b : make_aabb<T, N>(); }
+    inline bool is_empty() const { return mNodes.empty(); }
+    inline size_t size() const { return mIds.size(); }
+
+protected:
+    inline void recursive_build(
+        const T *coords,
+        const size_t stride,
+        const I ib,
+        const I ie,
+        const I curr,
+        const int threshold);
+
+    // squared distances of points [b, b + W) to point p
+    inline void sqr_distances(T *d2, const I b, const VectorN<T, N> &p) const;
+
+protected:
+    std::vector<BvhNode<T, N, I>> mNodes;
+    std::vector<T> mCoords[N]; // leaf order, padded by W
+    std::vector<id_type> mIds; // leaf order
+};
+
+template <typename T, size_t N, typename I, int W>
+inline void PointBvh<T, N, I, W>::recursive_build(
+    const T *coords,
+    const size_t stride,
+    const I ib,
+    const I ie,
+    const I curr,
+    const int threshold)
+{
+    auto bbox = make_aabb<T, N>();
+    for (I i = ib; i < ie; ++i)
+    {
+        const T *p = coords + mIds[i] * stride;
+        for (size_t d = 0; d < N; ++d)
+        {
+            bbox[0][d] = std::min(bbox[0][d], p[d]);
+            bbox[1][d] = std::max(bbox[1][d], p[d]);
+        }
+    }
+    mNodes[curr].b = bbox;
+
+    const size_t dim = longest_axis(bbox);
+
+    // make leaf if few points left or all points coincide
+    if (ie - ib <= threshold || !(bbox[0][dim] < bbox[1][dim]))
+    {
+        set_leaf(mNodes[curr], ib, ie - ib);
+        return;
+    }
+
+    const I im = ib + (ie - ib) / 2;
+
+    std::nth_element(mIds.begin() + ib, mIds.begin() + im, mIds.begin() + ie, [&](id_type a, id_type b)
+    { return coords[a * stride + dim] < coords[b * stride + dim]; });
+
+    I left = static_cast<I>(mNodes.size());
+    left_child(mNodes[curr]) = left;
+    mNodes.emplace_back();
+    recursive_build(coords, stride, ib, im, left, threshold);
+
+    I right = static_cast<I>(mNodes.size());
+    right_child(mNodes[curr]) = right;
+    mNodes.emplace_back();
+    recursive_build(coords, stride, im, ie, right, threshold);
+}
+
+template <typename T, size_t N, typename I, int W>
+inline void PointBvh<T, N, I, W>::build(
+    const T *coords,
+    const size_t n,
+    const int threshold,
+    const size_t stride)
+{
+    mNodes.clear();
+    mIds.resize(n);
+    if (n == 0) return;
+
+    for (size_t i = 0; i < n; ++i)
+        mIds[i] = static_cast<id_type>(i);
+
+    mNodes.reserve(2 * (n / std::max(threshold / 2, 1)) + 1);
+    mNodes.emplace_back();
+    recursive_build(coords, stride, 0, static_cast<I>(n), 0, std::max(threshold, 1));
+
+    for (size_t d = 0; d < N; ++d)
+    {
+        mCoords[d].assign(n + W, (T)0);
+        for (size_t i = 0; i < n; ++i)
+            mCoords[d][i] = coords[mIds[i] * stride + d];
+    }
+}
+
+template <typename T, size_t N, typename I, int W>
+inline void PointBvh<T, N, I, W>::sqr_distances(T *d2, const I b, const VectorN<T, N> &p) const
+{
+    for (int k = 0; k < W; ++k) d2[k] = 0;
+
+    for (size_t d = 0; d < N; ++d)
+    {
+        const T *x = &mCoords[d][b];
+        for (int k = 0; k < W; ++k)
+            d2[k] += (x[k] - p[d]) * (x[k] - p[d]);
+    }
+}
+
+template <typename T, size_t N, typename I, int W>
+template <class PointQuery>
+inline bool PointBvh<T, N, I, W>::radius_search(
+    PointQuery &query,
+    const VectorN<T, N> &center,
+    const T radius) const
+{
+    if (mNodes.empty()) return false;
+
+    const T r2 = radius * radius;
+
+    bool hit { false };
+    std::stack<I> recursive({ 0 });
+
+    while (!recursive.empty())
+    {
+        I curr = recursive.top(); recursive.pop();
+        const auto &node = mNodes[curr]; // safe reference
+
+        if (sqr_distance(node.b, center) > r2) continue;
+
+        if (is_leaf(node))
+        {
+            I ib = offset(node);
+            I ie = ib + length(node);
+
+            for (I b = ib; b < ie; b += W)
+            {
+                T d2[W];
+                sqr_distances(d2, b, center);
+
+                const int m = static_cast<int>(std::min<I>(W, ie - b));
+                for (int k = 0; k < m; ++k)
+                {
+                    if (d2[k] <= r2)
+                    {
+                        query(mIds[b + k], d2[k]);
+                        hit = true;
+                    }
+                }
+            }
+        }
+        else
+        {
+            recursive.push(right_child(node));
+            recursive.push(left_child(node));
+        }
+    }
+
+    return hit;
+}
+
+template <typename T, size_t N, typename I, int W>
+inline size_t PointBvh<T, N, I, W>::knn(
+    std::vector<std::pair<T, id_type>> &result,
+    const VectorN<T, N> &point,
+    const size_t k) const
+{
+    result.clear();
+    if (mNodes.empty() || k == 0) return 0;
+
+    // nodes visited nearest first, result kept as a max-heap
+    typedef std::pair<T, I> Entry;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+    queue.emplace(sqr_distance(mNodes[0].b, point), 0);
+
+    while (!queue.empty())
+    {
+        const auto curr = queue.top(); queue.pop();
+
+        if (result.size() == k && curr.first >= result.front().first) break;
+
+        const auto &node = mNodes[curr.second]; // safe reference
+
+        if (is_leaf(node))
+        {
+            I ib = offset(node);
+            I ie = ib + length(node);
+
+            for (I b = ib; b < ie; b += W)
+            {
+                T d2[W];
+                sqr_distances(d2, b, point);
+
+                const int m = static_cast<int>(std::min<I>(W, ie - b));
+                for (int j = 0; j < m; ++j)
+                {
+                    if (result.size() < k)
+                    {
+                        result.emplace_back(d2[j], mIds[b + j]);
+                        std::push_heap(result.begin(), result.end());
+                    }
+                    else if (d2[j] < result.front().first)
+                    {
+                        std::pop_heap(result.begin(), result.end());
+                        result.back() = { d2[j], mIds[b + j] };
+                        std::push_heap(result.begin(), result.end());
+                    }
+                }
+            }
+        }
+        else
+        {
+            queue.emplace(sqr_distance(mNodes[left_child(node)].b, point), left_child(node));
+            queue.emplace(sqr_distance(mNodes[right_child(node)].b, point), right_child(node));
+        }
+    }
+
+    std::sort_heap(result.begin(), result.end());
+    return result.size();
+}
+
+#endif // !BVH_POINTS_HH
@@ -0,0 +1,202 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_SPACE_FILLING_CURVE_HH
+#define BVH_SPACE_FILLING_CURVE_HH
+
+#include <cstdint>
+#include <numeric>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Space-filling curve codes
+////////////////////////////////////////////////////////////////
+
+/// Codes are 64 bits, i.e. 64/N bits per dimension (at most 32).
+/// Points are quantized in the given bounding box.
+
+template <typename T, size_t N>
+inline void sfc_impl_quantize(uint32_t (&x)[N], const VectorN<T, N> &p, const Aabb<T, N> &b, const int bits)
+{
+    const T scale = static_cast<T>((uint64_t(1) << bits) - 1);
+    for (size_t i = 0; i < N; ++i)
+    {
+        const T d = b[1][i] - b[0][i];
+        const T u = d > 0 ? (p[i] - b[0][i]) / d : (T)0;
+        x[i] = static_cast<uint32_t>(std::min(std::max(u, (T)0), (T)1) * scale);
+    }
+}
+
+// interleave bits, dimension 0 being the most significant
+template <size_t N>
+inline uint64_t sfc_impl_interleave(const uint32_t (&x)[N], const int bits)
+{
+    uint64_t code {};
+    for (int j = bits - 1; j >= 0; --j)
+        for (size_t i = 0; i < N; ++i)
+            code = (code << 1) | ((x[i] >> j) & 1);
+    return code;
+}
+
+template <size_t N>
+inline constexpr int sfc_impl_bits()
+{ return 64 / N > 32 ? 32 : (64 / N > 0 ? static_cast<int>(64 / N) : 1); }
+
+template <typename T, size_t N>
+inline uint64_t morton_code(const VectorN<T, N> &p, const Aabb<T, N> &b)
+{
+    constexpr int bits = sfc_impl_bits<N>();
+    uint32_t x[N];
+    sfc_impl_quantize(x, p, b, bits);
+    return sfc_impl_interleave(x, bits);
+}
+
+// J. Skilling, Programming the Hilbert curve, AIP 2004
+template <typename T, size_t N>
+inline uint64_t hilbert_code(const VectorN<T, N> &p, const Aabb<T, N> &b)
+{
+    constexpr int bits = sfc_impl_bits<N>();
+    uint32_t x[N];
+    sfc_impl_quantize(x, p, b, bits);
+
+    // inverse undo
+    for (uint32_t q = uint32_t(1) << (bits - 1); q > 1; q >>= 1)
+    {
+        const uint32_t r = q - 1;
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (x[i] & q) x[0] ^= r; // invert
+            else { uint32_t t = (x[0] ^ x[i]) & r; x[0] ^= t; x[i] ^= t; } // exchange
+        }
+    }
+
+    // gray encode
+    for (size_t i = 1; i < N; ++i) x[i] ^= x[i - 1];
+    uint32_t t {};
+    for (uint32_t q = uint32_t(1) << (bits - 1); q > 1; q >>= 1)
+        if (x[N - 1] & q) t ^= q - 1;
+    for (size_t i = 0; i < N; ++i) x[i] ^= t;
+
+    return sfc_impl_interleave(x, bits);
+}
+
+////////////////////////////////////////////////////////////////
+/// Orderings
+////////////////////////////////////////////////////////////////
+
+/// Order of points along a space-filling curve, order[i] being the
+/// index of the i-th point. Used to sort primitive centroids or
+/// incoming query batches (e.g. ray origins) for coherent access.
+template <typename T, size_t N>
+inline std::vector<uint32_t> curve_order(const std::vector<VectorN<T, N>> &points, bool hilbert = true)
+{
+    auto bbox = make_aabb<T, N>();
+    for (const auto &p : points) bbox = merge(bbox, make_aabb(p));
+
+    std::vector<std::pair<uint64_t, uint32_t>> codes(points.size());
+    for (size_t i = 0; i < points.size(); ++i)
+        codes[i] = { hilbert ? hilbert_code(points[i], bbox) : morton_code(points[i], bbox), static_cast<uint32_t>(i) };
+    std::sort(codes.begin(), codes.end());
+
+    std::vector<uint32_t> order(points.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = codes[i].second;
+    return order;
+}
+
+/// Order of primitive ids in the leaves of a tree built on ids
+template <class Primitive, typename T, size_t N, class Node>
+inline std::vector<uint32_t> leaf_order(const Bvh<Primitive, T, N, Node> &bvh)
+{
+    const auto &ids = bvh.primitives();
+    std::vector<uint32_t> order(ids.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<uint32_t>(ids[i]);
+    return order;
+}
+
+/// Vertex remap (old -> new index) numbering vertices by first use
+/// when visiting faces in the given order. Vertices used by no face
+/// are placed at the end.
+template <class Face>
+inline std::vector<uint32_t> vertex_remap(
+    const std::vector<Face> &faces,
+    const std::vector<uint32_t> &order,
+    const size_t nVertices)
+{
+    const uint32_t unset = ~uint32_t(0);
+    std::vector<uint32_t> remap(nVertices, unset);
+    uint32_t next {};
+
+    for (uint32_t fid : order)
+        for (size_t k = 0; k < faces[fid].size(); ++k)
+            if (remap[faces[fid][k]] == unset)
+                remap[faces[fid][k]] = next++;
+
+    for (auto &r : remap) if (r == unset) r = next++;
+    return remap;
+}
+
+////////////////////////////////////////////////////////////////
+/// Applying orderings
+////////////////////////////////////////////////////////////////
+
+/// data[i] <- data[order[i]]
+template <class X>
+inline void gather(std::vector<X> &data, const std::vector<uint32_t> &order)
+{
+    std::vector<X> out; out.reserve(order.size());
+    for (uint32_t i : order) out.push_back(std::move(data[i]));
+    data.swap(out);
+}
+
+/// data[remap[i]] <- data[i]
+template <class X>
+inline void scatter(std::vector<X> &data, const std::vector<uint32_t> &remap)
+{
+    std::vector<X> out(data.size());
+    for (size_t i = 0; i < remap.size(); ++i) out[remap[i]] = std::move(data[i]);
+    data.swap(out);
+}
+
+/// face[k] <- remap[face[k]]
+template <class Face>
+inline void reindex(std::vector<Face> &faces, const std::vector<uint32_t> &remap)
+{
+    for (auto &f : faces)
+        for (size_t k = 0; k < f.size(); ++k)
+            f[k] = static_cast<typename std::decay<decltype(f[k])>::type>(remap[f[k]]);
+}
+
+////////////////////////////////////////////////////////////////
+/// Mesh reordering example
+////////////////////////////////////////////////////////////////
+
+/// auto forder = leaf_order(bvh);                    // faces in leaf order
+/// auto vremap = vertex_remap(fs, forder, vs.size()); // vertices by first use
+/// gather(fs, forder);
+/// reindex(fs, vremap);
+/// scatter(vs, vremap);
+/// std::iota(bvh.primitives().begin(), bvh.primitives().end(), 0); // i-th leaf slot is face i
+/// 
+/// auto qorder = curve_order(origins); // trace rays in this order
+
+#endif // !BVH_SPACE_FILLING_CURVE_HH
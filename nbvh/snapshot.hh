@@ -0,0 +1,150 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_SNAPSHOT_HH
+#define BVH_SNAPSHOT_HH
+
+#include <mutex>
+#include <atomic>
+#include <future>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Double-buffered Bvh
+////////////////////////////////////////////////////////////////
+
+/// Readers query the front tree while a writer rebuilds the back
+/// tree and then publishes it by flipping the front index.
+/// Readers never wait: pinning a snapshot takes two atomic ops
+/// (plus a retry if a publish happened in between). The writer
+/// reclaims a retired tree only after all readers pinned on it
+/// have released their snapshots.
+template <class Primitive, typename T, size_t N, class Node = BvhNode<T, N>>
+class SnapshotBvh
+{
+public:
+    typedef Bvh<Primitive, T, N, Node> tree_type;
+
+    class Snapshot
+    {
+    public:
+        Snapshot(Snapshot &&s) noexcept: mTree(s.mTree), mReaders(s.mReaders) { s.mReaders = nullptr; }
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+        ~Snapshot() { if (mReaders) mReaders->fetch_sub(1); }
+
+        inline const tree_type &operator*() const { return *mTree; }
+        inline const tree_type *operator->() const { return mTree; }
+
+    protected:
+        friend class SnapshotBvh;
+        Snapshot(const tree_type *tree, std::atomic<int> *readers): mTree(tree), mReaders(readers) {}
+        const tree_type *mTree;
+        std::atomic<int> *mReaders;
+    };
+
+public:
+    /// Pin the current tree, it stays immutable while the snapshot lives.
+    inline Snapshot snapshot() const;
+
+    /// Build the back tree by builder(tree_type &) and publish it.
+    /// Writers are serialized; readers are never blocked.
+    template <class Builder>
+    inline void rebuild(const Builder &builder);
+
+    /// Same as rebuild but on a background thread.
+    template <class Builder>
+    inline std::future<void> rebuild_async(Builder builder);
+
+    /// Number of published trees.
+    inline unsigned long long generation() const { return mGeneration.load(); }
+
+protected:
+    tree_type mTrees[2];
+    std::atomic<int> mFront { 0 };
+    mutable std::atomic<int> mReaders[2] { { 0 }, { 0 } };
+    std::atomic<unsigned long long> mGeneration { 0 };
+    std::mutex mWriter;
+};
+
+template <class Primitive, typename T, size_t N, class Node>
+inline typename SnapshotBvh<Primitive, T, N, Node>::Snapshot
+SnapshotBvh<Primitive, T, N, Node>::snapshot() const
+{
+    for (;;)
+    {
+        const int i = mFront.load();
+        mReaders[i].fetch_add(1);
+
+        // The writer may have retired tree i before it saw our count,
+        // pin the new front instead.
+        if (mFront.load() == i)
+            return Snapshot(&mTrees[i], &mReaders[i]);
+
+        mReaders[i].fetch_sub(1);
+    }
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class Builder>
+inline void SnapshotBvh<Primitive, T, N, Node>::rebuild(const Builder &builder)
+{
+    std::lock_guard<std::mutex> lock(mWriter);
+
+    const int back = 1 - mFront.load();
+
+    // wait for readers still holding the retired tree
+    while (mReaders[back].load() != 0)
+        std::this_thread::yield();
+
+    mTrees[back].clear();
+    builder(mTrees[back]);
+
+    mFront.store(back);
+    mGeneration.fetch_add(1);
+}
+
+template <class Primitive, typename T, size_t N, class Node>
+template <class Builder>
+inline std::future<void> SnapshotBvh<Primitive, T, N, Node>::rebuild_async(Builder builder)
+{
+    return std::async(std::launch::async, [this, builder] { rebuild(builder); });
+}
+
+////////////////////////////////////////////////////////////////
+/// Snapshot example
+////////////////////////////////////////////////////////////////
+
+/// SnapshotBvh<Primitive, T, N> scene;
+/// 
+/// // writer thread
+/// auto done = scene.rebuild_async([&] (Bvh<Primitive, T, N> &bvh)
+/// { bvh.build(primitives.begin(), primitives.end(), bound, split, 1); });
+/// 
+/// // reader threads
+/// {
+///     auto tree = scene.snapshot();
+///     tree->intersect(collide, org, dir, dist);
+/// }
+
+#endif // !BVH_SNAPSHOT_HH
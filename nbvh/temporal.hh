@@ -0,0 +1,237 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_TEMPORAL_HH
+#define BVH_TEMPORAL_HH
+
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Temporal Bvh
+////////////////////////////////////////////////////////////////
+
+/// Box of a primitive swept through all time keys, which is what
+/// the tree structure is built upon.
+template <class PrimitiveBound, typename T, size_t N, size_t K>
+struct SweptBound
+{
+    SweptBound(const PrimitiveBound &bound): bound(bound) {}
+    template <class Primitive>
+    inline Aabb<T, N> operator() (const Primitive &primitive) const
+    {
+        auto bbox = make_aabb<T, N>();
+        for (size_t k = 0; k < K; ++k) bbox = merge(bbox, bound(primitive, k));
+        return bbox;
+    }
+    const PrimitiveBound &bound;
+};
+
+/// Bvh over moving primitives. Every node keeps its box at K time
+/// keys evenly spaced over [0, 1], and the box at any time is the
+/// linear interpolation of the two keys around it, which encloses
+/// primitives whose vertices move linearly between keys.
+/// Node is the node type of the tree as for Bvh, the boxes at
+/// keys are kept in T.
+template <class Primitive, typename T, size_t N, size_t K = 2, class Node = BvhNode<T, N>>
+class TemporalBvh
+{
+    static_assert(K >= 2, "at least two time keys");
+
+public:
+    typedef T value_type;
+    typedef Bvh<Primitive, T, N, Node> tree_type;
+    typedef typename Node::index_type index_type;
+
+public:
+    /// bound(primitive, k) is the box of primitive at the k-th key
+    template <template <class, class, typename, size_t> class PrimitiveSplit, class PrimitiveBound>
+    inline void build(
+        std::vector<Primitive> &primitives,
+        const PrimitiveBound &bound,
+        const int threshold = 1);
+
+    /// collide(primitive, org, dir, time, dist)
+    template <class PrimitiveCollide>
+    inline bool intersect(
+        PrimitiveCollide &collide,
+        const VectorN<T, N> &org,
+        const VectorN<T, N> &dir,
+        const T time,
+        T &dist) const;
+
+    /// query(box) is called with boxes swept over [t0, t1]
+    template <class RangeQuery>
+    inline bool search(
+        RangeQuery &query,
+        const T t0,
+        const T t1) const;
+
+    inline Aabb<T, N> aabb(size_t node, T time) const;
+    inline Aabb<T, N> aabb(size_t node, T t0, T t1) const;
+
+    inline const tree_type &tree() const { return mTree; }
+    inline const std::vector<Primitive> &primitives() const { return mTree.primitives(); }
+    inline bool is_empty() const { return mTree.is_empty(); }
+
+protected:
+    tree_type mTree;              // structure and boxes swept over all keys
+    std::vector<Aabb<T, N>> mKeys; // K boxes per node
+};
+
+template <class Primitive, typename T, size_t N, size_t K, class Node>
+template <template <class, class, typename, size_t> class PrimitiveSplit, class PrimitiveBound>
+inline void TemporalBvh<Primitive, T, N, K, Node>::build(
+    std::vector<Primitive> &primitives,
+    const PrimitiveBound &bound,
+    const int threshold)
+{
+    SweptBound<PrimitiveBound, T, N, K> swept(bound);
+    PrimitiveSplit<Primitive, decltype(swept), T, N> split(swept);
+    mTree.clear();
+    mTree.build(primitives, swept, split, threshold);
+
+    const auto &nodes = mTree.nodes();
+    const auto &prims = mTree.primitives();
+    mKeys.assign(nodes.size() * K, make_aabb<T, N>());
+
+    // children are stored after their parent, refit bottom-up
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        const auto &node = nodes[i];
+
+        for (size_t k = 0; k < K; ++k)
+        {
+            auto &bbox = mKeys[i * K + k];
+
+            if (is_leaf(node))
+            {
+                auto ib = offset(node);
+                auto ie = ib + length(node);
+                for (auto j = ib; j < ie; ++j)
+                    bbox = merge(bbox, bound(prims[j], k));
+            }
+            else
+            {
+                bbox = merge(mKeys[left_child(node) * K + k], mKeys[right_child(node) * K + k]);
+            }
+        }
+    }
+}
+
+template <class Primitive, typename T, size_t N, size_t K, class Node>
+inline Aabb<T, N> TemporalBvh<Primitive, T, N, K, Node>::aabb(size_t node, T time) const
+{
+    const T s = std::min(std::max(time, (T)0), (T)1) * (T)(K - 1);
+    const size_t k = std::min(static_cast<size_t>(s), K - 2);
+    const T f = s - (T)k;
+    const auto &b0 = mKeys[node * K + k];
+    const auto &b1 = mKeys[node * K + k + 1];
+    return { b0[0] + (b1[0] - b0[0]) * f, b0[1] + (b1[1] - b0[1]) * f };
+}
+
+template <class Primitive, typename T, size_t N, size_t K, class Node>
+inline Aabb<T, N> TemporalBvh<Primitive, T, N, K, Node>::aabb(size_t node, T t0, T t1) const
+{
+    // boxes move linearly between keys, so the extremes are
+    // reached either at the ends of interval or at keys in between
+    auto bbox = merge(aabb(node, t0), aabb(node, t1));
+    for (size_t k = 1; k + 1 < K; ++k)
+    {
+        const T tk = (T)k / (T)(K - 1);
+        if (t0 < tk && tk < t1) bbox = merge(bbox, mKeys[node * K + k]);
+    }
+    return bbox;
+}
+
+template <class Primitive, typename T, size_t N, size_t K, class Node>
+template <class PrimitiveCollide>
+inline bool TemporalBvh<Primitive, T, N, K, Node>::intersect(
+    PrimitiveCollide &collide,
+    const VectorN<T, N> &org,
+    const VectorN<T, N> &dir,
+    const T time,
+    T &dist) const
+{
+    const auto &prims = mTree.primitives();
+
+    // boxes at the time instead of the swept ones of the tree
+    struct TimedRayNodeTest : public RayNodeTest<T, N>
+    {
+        TimedRayNodeTest(const TemporalBvh &bvh, const T time, const VectorN<T, N> &org, const VectorN<T, N> &dir, const T &dist):
+            RayNodeTest<T, N>(org, dir, dist), bvh(bvh), time(time) {}
+        inline bool operator() (const Aabb<T, N> &, const index_type node) const
+        { return is_intersecting(bvh.aabb(node, time), this->org, this->inv, this->dist, true); }
+        const TemporalBvh &bvh;
+        const T time;
+    } test(*this, time, org, dir, dist);
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (collide(prims[i], org, dir, time, dist))
+                hit = true;
+        return hit;
+    };
+
+    return mTree.template traverse<NearFirst, AllHits>(test, visit);
+}
+
+template <class Primitive, typename T, size_t N, size_t K, class Node>
+template <class RangeQuery>
+inline bool TemporalBvh<Primitive, T, N, K, Node>::search(
+    RangeQuery &query,
+    const T t0,
+    const T t1) const
+{
+    const auto &prims = mTree.primitives();
+
+    auto test = [&] (const Aabb<T, N> &, const index_type node) { return query(aabb(node, t0, t1)); };
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        bool hit { false };
+        for (auto i = ib; i < ie; ++i)
+            if (query(prims[i]))
+                hit = true;
+        return hit;
+    };
+
+    return mTree.template traverse<DepthFirst, AllHits>(test, visit);
+}
+
+////////////////////////////////////////////////////////////////
+/// Temporal Bvh example
+////////////////////////////////////////////////////////////////
+
+/// struct MovingBound
+/// {
+///     Aabb<T, N> operator() (const Primitive &primitive, size_t key) const;
+/// };
+/// 
+/// TemporalBvh<Primitive, T, N, 2> bvh;
+/// bvh.build<SAHSplit>(primitives, bound, 1);
+/// bvh.intersect(collide, org, dir, time, dist);
+/// bvh.search(query, t0, t1);
+
+#endif // !BVH_TEMPORAL_HH
@@ -0,0 +1,259 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_TRIANGLE_HH
+#define BVH_TRIANGLE_HH
+
+#include <limits>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Leaf triangles
+////////////////////////////////////////////////////////////////
+
+/// Triangle vertices copied into the leaf order of a Bvh, one
+/// structure-of-arrays per coordinate. Triangles of a leaf are
+/// contiguous and tested W at a time by a branch-free kernel the
+/// compiler vectorizes, with no indirection into user meshes.
+template <typename T, int W = 8>
+class TriangleLeaves
+{
+public:
+    typedef T value_type;
+    static constexpr int width = W;
+
+public:
+    /// vertices(primitive, v0, v1, v2) writes the triangle of a primitive
+    template <class Primitive, class Node, class TriangleVertices>
+    inline void build(
+        const Bvh<Primitive, T, 3, Node> &bvh,
+        const TriangleVertices &vertices);
+
+    /// Moller-Trumbore test against triangles [ib, ie), edges are
+    /// evaluated in registers.
+    template <typename I>
+    inline bool intersect(
+        I ib, I ie,
+        const VectorN<T, 3> &org,
+        const VectorN<T, 3> &dir,
+        T &dist, I &slot,
+        bool culling) const;
+
+    /// Watertight test (S. Woop, C. Benthin, I. Wald, JCGT 2013)
+    /// against triangles [ib, ie), no gaps along shared edges.
+    template <typename I>
+    inline bool intersect_watertight(
+        I ib, I ie,
+        const VectorN<T, 3> &org,
+        const VectorN<T, 3> &dir,
+        T &dist, I &slot,
+        bool culling) const;
+
+    inline size_t size() const { return mSize; }
+
+protected:
+    // x, y, z of v0, v1, v2, padded to a multiple of W
+    std::vector<T> mV[9];
+    size_t mSize { 0 };
+};
+
+template <typename T, int W>
+template <class Primitive, class Node, class TriangleVertices>
+inline void TriangleLeaves<T, W>::build(
+    const Bvh<Primitive, T, 3, Node> &bvh,
+    const TriangleVertices &vertices)
+{
+    const auto &primitives = bvh.primitives();
+    mSize = primitives.size();
+
+    // pad by a full block so a block can start at any triangle
+    for (auto &v : mV) v.assign(mSize + W, (T)0);
+
+    VectorN<T, 3> v[3];
+
+    for (size_t i = 0; i < mSize; ++i)
+    {
+        vertices(primitives[i], v[0], v[1], v[2]);
+        for (int j = 0; j < 3; ++j)
+            for (int k = 0; k < 3; ++k)
+                mV[j * 3 + k][i] = v[j][k];
+    }
+}
+
+template <typename T, int W>
+template <typename I>
+inline bool TriangleLeaves<T, W>::intersect(
+    I ib, I ie,
+    const VectorN<T, 3> &org,
+    const VectorN<T, 3> &dir,
+    T &dist, I &slot,
+    bool culling) const
+{
+    constexpr T kEps = std::numeric_limits<T>::epsilon();
+    constexpr T kInf = std::numeric_limits<T>::infinity();
+
+    bool hit { false };
+
+    for (I b = ib; b < ie; b += W)
+    {
+        const T *x0 = &mV[0][b], *y0 = &mV[1][b], *z0 = &mV[2][b];
+        const T *x1 = &mV[3][b], *y1 = &mV[4][b], *z1 = &mV[5][b];
+        const T *x2 = &mV[6][b], *y2 = &mV[7][b], *z2 = &mV[8][b];
+
+        T ts[W];
+
+        for (int k = 0; k < W; ++k)
+        {
+            const T e1x = x1[k] - x0[k], e1y = y1[k] - y0[k], e1z = z1[k] - z0[k];
+            const T e2x = x2[k] - x0[k], e2y = y2[k] - y0[k], e2z = z2[k] - z0[k];
+
+            // P = dir x e2
+            const T px = dir[1] * e2z - dir[2] * e2y;
+            const T py = dir[2] * e2x - dir[0] * e2z;
+            const T pz = dir[0] * e2y - dir[1] * e2x;
+            const T det = e1x * px + e1y * py + e1z * pz;
+            const T inv = (T)1 / det;
+
+            const T sx = org[0] - x0[k], sy = org[1] - y0[k], sz = org[2] - z0[k];
+            const T u = (sx * px + sy * py + sz * pz) * inv;
+
+            // Q = s x e1
+            const T qx = sy * e1z - sz * e1y;
+            const T qy = sz * e1x - sx * e1z;
+            const T qz = sx * e1y - sy * e1x;
+            const T v = (dir[0] * qx + dir[1] * qy + dir[2] * qz) * inv;
+            const T t = (e2x * qx + e2y * qy + e2z * qz) * inv;
+
+            const bool valid = (culling ? det > 0 : std::abs(det) >= kEps)
+                & (u >= 0) & (u <= 1) & (v >= 0) & (u + v <= 1) & (t > 0);
+            ts[k] = valid ? t : kInf;
+        }
+
+        const int m = static_cast<int>(std::min<I>(W, ie - b));
+
+        for (int k = 0; k < m; ++k)
+        {
+            if (dist > ts[k])
+            {
+                dist = ts[k];
+                slot = b + k;
+                hit = true;
+            }
+        }
+    }
+
+    return hit;
+}
+
+template <typename T, int W>
+template <typename I>
+inline bool TriangleLeaves<T, W>::intersect_watertight(
+    I ib, I ie,
+    const VectorN<T, 3> &org,
+    const VectorN<T, 3> &dir,
+    T &dist, I &slot,
+    bool culling) const
+{
+    constexpr T kInf = std::numeric_limits<T>::infinity();
+
+    // permute axes so that the ray goes along +z, then shear
+    const int kz = static_cast<int>(argmax(abs(dir)));
+    int kx = (kz + 1) % 3;
+    int ky = (kx + 1) % 3;
+    if (dir[kz] < 0) std::swap(kx, ky);
+
+    const T Sx = dir[kx] / dir[kz];
+    const T Sy = dir[ky] / dir[kz];
+    const T Sz = (T)1 / dir[kz];
+
+    // front facing triangles have non-negative scaled barycentrics
+    bool hit { false };
+
+    for (I b = ib; b < ie; b += W)
+    {
+        const T *ax = &mV[0 + kx][b], *ay = &mV[0 + ky][b], *az = &mV[0 + kz][b];
+        const T *bx = &mV[3 + kx][b], *by = &mV[3 + ky][b], *bz = &mV[3 + kz][b];
+        const T *cx = &mV[6 + kx][b], *cy = &mV[6 + ky][b], *cz = &mV[6 + kz][b];
+
+        T ts[W];
+
+        for (int k = 0; k < W; ++k)
+        {
+            const T Az = az[k] - org[kz], Bz = bz[k] - org[kz], Cz = cz[k] - org[kz];
+            const T Ax = ax[k] - org[kx] - Sx * Az, Ay = ay[k] - org[ky] - Sy * Az;
+            const T Bx = bx[k] - org[kx] - Sx * Bz, By = by[k] - org[ky] - Sy * Bz;
+            const T Cx = cx[k] - org[kx] - Sx * Cz, Cy = cy[k] - org[ky] - Sy * Cz;
+
+            // scaled barycentrics
+            const T U = Cx * By - Cy * Bx;
+            const T V = Ax * Cy - Ay * Cx;
+            const T Q = Bx * Ay - By * Ax;
+            const T det = U + V + Q;
+
+            const T t = (U * Az + V * Bz + Q * Cz) * Sz / det;
+
+            const bool inside = culling
+                ? (U >= 0) & (V >= 0) & (Q >= 0)
+                : ((U <= 0) & (V <= 0) & (Q <= 0)) | ((U >= 0) & (V >= 0) & (Q >= 0));
+            const bool valid = inside & (det != 0) & (t > 0);
+            ts[k] = valid ? t : kInf;
+        }
+
+        const int m = static_cast<int>(std::min<I>(W, ie - b));
+
+        for (int k = 0; k < m; ++k)
+        {
+            if (dist > ts[k])
+            {
+                dist = ts[k];
+                slot = b + k;
+                hit = true;
+            }
+        }
+    }
+
+    return hit;
+}
+
+////////////////////////////////////////////////////////////////
+/// Leaf triangle collide
+////////////////////////////////////////////////////////////////
+
+/// Leaf collide program for Bvh::intersect_leaves. The primitive
+/// hit is bvh.primitives()[slot], I is the index type of the nodes.
+template <typename T, bool Watertight = false, int W = 8, typename I = int>
+struct TriangleLeafCollide
+{
+    TriangleLeafCollide(const TriangleLeaves<T, W> &leaves, bool culling = true): leaves(leaves), culling(culling) {}
+    inline bool operator() (I ib, I ie, const VectorN<T, 3> &org, const VectorN<T, 3> &dir, T &dist)
+    {
+        return Watertight
+            ? leaves.intersect_watertight(ib, ie, org, dir, dist, slot, culling)
+            : leaves.intersect(ib, ie, org, dir, dist, slot, culling);
+    }
+    const TriangleLeaves<T, W> &leaves;
+    bool culling;
+    I slot { -1 };
+};
+
+#endif // !BVH_TRIANGLE_HH
@@ -0,0 +1,201 @@
+// ======================================================================== //
+// Copyright (c) 2023 Ingram Inxent                                         //
+//                                                                          //
+// Permission is hereby granted, free of charge, to any person obtaining    //
+// a copy of this software and associated documentation files (the          //
+// "Software"), to deal in the Software without restriction, including      //
+// without limitation the rights to use, copy, modify, merge, publish,      //
+// distribute, sublicense, and/or sell copies of the Software, and to       //
+// permit persons to whom the Software is furnished to do so, subject to    //
+// the following conditions:                                                //
+//                                                                          //
+// The above copyright notice and this permission notice shall be           //
+// included in all copies or substantial portions of the Software.          //
+//                                                                          //
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,          //
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF       //
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND                    //
+// NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE   //
+// LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION   //
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION    //
+// WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.          //
+// ======================================================================== //
+
+#ifndef BVH_WINDING_HH
+#define BVH_WINDING_HH
+
+#include <cmath>
+#include <thread>
+#include "bvh.hh"
+
+////////////////////////////////////////////////////////////////
+/// Fast winding number
+////////////////////////////////////////////////////////////////
+
+/// Generalized winding number of a triangle soup (G. Barill, N. Dickson,
+/// R. Schmidt, D. Levin, A. Jacobson, SIGGRAPH 2018). Every node keeps
+/// the dipole of its triangles: the sum of area-weighted normals at their
+/// area-weighted center, and the radius of a ball around it enclosing them.
+/// A node farther than beta radii from the query is evaluated by its dipole,
+/// closer leaves by exact solid angles. The winding number is about 1 inside
+/// a closed mesh with outward normals and 0 outside, higher beta being more
+/// accurate and slower. The tree must outlive and not change after build.
+template <class Primitive, typename T, class Node = BvhNode<T, 3>>
+class WindingNumber
+{
+public:
+    typedef T value_type;
+    typedef Bvh<Primitive, T, 3, Node> tree_type;
+    typedef typename Node::index_type index_type;
+
+public:
+    /// vertices(primitive, v0, v1, v2) writes the triangle of a primitive
+    template <class TriangleVertices>
+    inline WindingNumber(const tree_type &bvh, const TriangleVertices &vertices);
+
+    inline T operator() (const VectorN<T, 3> &q, const T beta = 2) const;
+
+    inline bool is_inside(const VectorN<T, 3> &q, const T beta = 2) const { return (*this)(q, beta) > (T)0.5; }
+
+    /// Winding numbers of n points, split among threads
+    inline void batch(
+        const VectorN<T, 3> *points,
+        T *numbers,
+        const size_t n,
+        const int threads = 1,
+        const T beta = 2) const;
+
+protected:
+    inline T solid_angle(const VectorN<T, 3> &q, size_t i) const;
+
+protected:
+    const tree_type &mBvh;
+    std::vector<VectorN<T, 3>> mV;       // 3 vertices per primitive, in leaf order
+    std::vector<VectorN<T, 3>> mCenters; // per node
+    std::vector<VectorN<T, 3>> mNormals; // per node, area weighted
+    std::vector<T> mRadii;               // per node
+};
+
+template <class Primitive, typename T, class Node>
+template <class TriangleVertices>
+inline WindingNumber<Primitive, T, Node>::WindingNumber(
+    const tree_type &bvh,
+    const TriangleVertices &vertices): mBvh(bvh)
+{
+    const auto &primitives = bvh.primitives();
+    const auto &nodes = bvh.nodes();
+
+    mV.resize(primitives.size() * 3);
+    for (size_t i = 0; i < primitives.size(); ++i)
+        vertices(primitives[i], mV[i * 3], mV[i * 3 + 1], mV[i * 3 + 2]);
+
+    mCenters.assign(nodes.size(), make_vector<T, 3>(0));
+    mNormals.assign(nodes.size(), make_vector<T, 3>(0));
+    mRadii.assign(nodes.size(), (T)0);
+    std::vector<T> areas(nodes.size(), (T)0);
+
+    // children are stored after their parent, fit bottom-up
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        const auto &node = nodes[i];
+
+        if (is_leaf(node))
+        {
+            auto ib = offset(node);
+            auto ie = ib + length(node);
+
+            for (auto j = ib; j < ie; ++j)
+            {
+                const auto *v = &mV[j * 3];
+                const auto an = cross(v[1] - v[0], v[2] - v[0]) * (T)0.5;
+                const T a = norm2(an);
+                mNormals[i] = mNormals[i] + an;
+                mCenters[i] = mCenters[i] + (v[0] + v[1] + v[2]) * (a / (T)3);
+                areas[i] += a;
+            }
+
+            if (areas[i] > 0) mCenters[i] = mCenters[i] / areas[i];
+            else mCenters[i] = centroid(aabb_cast<T>(node.b));
+
+            for (auto j = ib * 3; j < ie * 3; ++j)
+                mRadii[i] = std::max(mRadii[i], norm2(mV[j] - mCenters[i]));
+        }
+        else
+        {
+            const auto l = left_child(node);
+            const auto r = right_child(node);
+            areas[i] = areas[l] + areas[r];
+            mNormals[i] = mNormals[l] + mNormals[r];
+            if (areas[i] > 0) mCenters[i] = (mCenters[l] * areas[l] + mCenters[r] * areas[r]) / areas[i];
+            else mCenters[i] = centroid(aabb_cast<T>(node.b));
+            mRadii[i] = std::max(
+                norm2(mCenters[l] - mCenters[i]) + mRadii[l],
+                norm2(mCenters[r] - mCenters[i]) + mRadii[r]);
+        }
+    }
+}
+
+// Solid angle of a triangle (A. Van Oosterom, J. Strackee, 1983)
+template <class Primitive, typename T, class Node>
+inline T WindingNumber<Primitive, T, Node>::solid_angle(const VectorN<T, 3> &q, size_t i) const
+{
+    const auto a = mV[i * 3] - q;
+    const auto b = mV[i * 3 + 1] - q;
+    const auto c = mV[i * 3 + 2] - q;
+    const T la = norm2(a), lb = norm2(b), lc = norm2(c);
+    const T det = dot(a, cross(b, c));
+    const T div = la * lb * lc + dot(a, b) * lc + dot(a, c) * lb + dot(b, c) * la;
+    return (T)2 * std::atan2(det, div);
+}
+
+template <class Primitive, typename T, class Node>
+inline T WindingNumber<Primitive, T, Node>::operator() (const VectorN<T, 3> &q, const T beta) const
+{
+    const T k4Pi = (T)(4 * 3.14159265358979323846);
+    T w { 0 };
+
+    // nodes far enough stand for their subtree by their dipole
+    auto test = [&] (const Aabb<T, 3> &, const index_type node)
+    {
+        const auto d = mCenters[node] - q;
+        const T l = norm2(d);
+        if (l <= beta * mRadii[node]) return true;
+        w += dot(d, mNormals[node]) / (k4Pi * l * l * l);
+        return false;
+    };
+
+    auto visit = [&] (index_type ib, index_type ie)
+    {
+        for (auto i = ib; i < ie; ++i)
+            w += solid_angle(q, i) / k4Pi;
+        return false;
+    };
+
+    mBvh.template traverse<DepthFirst, AllHits>(test, visit);
+    return w;
+}
+
+template <class Primitive, typename T, class Node>
+inline void WindingNumber<Primitive, T, Node>::batch(
+    const VectorN<T, 3> *points,
+    T *numbers,
+    const size_t n,
+    const int threads,
+    const T beta) const
+{
+    auto run = [&] (size_t ib, size_t ie)
+    {
+        for (size_t i = ib; i < ie; ++i)
+            numbers[i] = (*this)(points[i], beta);
+    };
+
+    if (threads <= 1) { run(0, n); return; }
+
+    std::vector<std::thread> workers;
+    const size_t chunk = (n + threads - 1) / threads;
+    for (int t = 0; t < threads; ++t)
+        workers.emplace_back(run, std::min(n, t * chunk), std::min(n, (t + 1) * chunk));
+    for (auto &worker : workers) worker.join();
+}
+
+#endif // !BVH_WINDING_HH
@@ -68,5 +68,8 @@ int main(int argc, const char **argv)
     std::cout << "is ray intersecting box = " << is_intersecting(b8, {  0,-1,-1 }, { 1,1,1 }, 1e10) << std::endl;
     std::cout << "is ray intersecting box = " << is_intersecting(b8, { -1, 0,-1 }, { 1,1,1 }, 1e10) << std::endl;
     std::cout << "is ray intersecting box = " << is_intersecting(b8, { -1,-1, 0 }, { 1,1,1 }, 1e10) << std::endl;
+    Box3 bt = make_aabb<double, 3>(Vec3 { 0.1, 0.2, 0.3 }, Vec3 { 1.1, 1.2, 1.3 });
+    Aabb<float, 3> bf = aabb_cast<float>(bt);
+    std::cout << "is " << bt.p[0] << ", " << bt.p[1] << " inside float box = " << is_inside(aabb_cast<double>(bf), bt) << std::endl;
     return 0;
 }
\ No newline at end of file
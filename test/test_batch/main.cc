@@ -0,0 +1,465 @@
+#include <chrono>
+#include <random>
+#include <thread>
+#include "bvh.hh"
+#include "lazy.hh"
+#include "dop.hh"
+#include "grid.hh"
+#include "forest.hh"
+
+using Vec3 = VectorN<double, 3>;
+using Box3 = Aabb<double, 3>;
+
+struct Triangle { Vec3 v[3]; };
+
+struct TriangleBound
+{
+    inline Box3 operator() (const Triangle &t) const { return make_aabb<double, 3>(t.v[0], t.v[1], t.v[2]); }
+};
+
+inline bool is_intersecting(const Triangle &tri, const Vec3 &org, const Vec3 &dir, double &dist)
+{
+    auto v01 = tri.v[1] - tri.v[0];
+    auto v02 = tri.v[2] - tri.v[0];
+    auto pvc = cross(dir, v02);
+    double det = dot(v01, pvc);
+    if (std::abs(det) < 1e-12) return false;
+    double inv = 1 / det;
+    auto tvc = org - tri.v[0];
+    double u = dot(tvc, pvc) * inv;
+    if (u < 0 || u > 1) return false;
+    auto qvc = cross(tvc, v01);
+    double v = dot(dir, qvc) * inv;
+    if (v < 0 || u + v > 1) return false;
+    double t = dot(v02, qvc) * inv;
+    if (t > 0 && dist > t) { dist = t; return true; }
+    return false;
+}
+
+struct TriangleCollide
+{
+    inline bool operator() (const Triangle &t, const Vec3 &org, const Vec3 &dir, double &dist) const
+    { return is_intersecting(t, org, dir, dist); }
+};
+
+struct TriangleBatchCollide
+{
+    inline bool operator() (size_t q, const Triangle &t, const Vec3 &org, const Vec3 &dir, double &dist) const
+    { return is_intersecting(t, org, dir, dist); }
+};
+
+struct BoxSearch
+{
+    inline bool operator() (const Box3 &b) const { return is_intersecting(box, b); }
+    inline bool operator() (const Triangle &t) { if (is_intersecting(box, bound(t))) ++count; return false; }
+    Box3 box;
+    TriangleBound bound;
+    size_t count { 0 };
+};
+
+template <size_t D>
+struct TriangleDop
+{
+    inline Dop<double, 3, D> operator() (const Triangle &t) const { return make_dop<double, 3, D>(t.v[0], t.v[1], t.v[2]); }
+};
+
+template <size_t D, class Node = BvhNode<double, 3>>
+void trace_dop(std::vector<Triangle> tris, const std::vector<Vec3> &orgs, const std::vector<Vec3> &dirs, std::vector<double> &dists)
+{
+    DopBvh<Triangle, double, 3, D, Node> bvh;
+    bvh.template build<SAHSplit>(tris, TriangleDop<D>(), 4);
+
+    TriangleCollide collide;
+    TraversalStats stats;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < orgs.size(); ++i)
+        bvh.intersect(collide, orgs[i], dirs[i], dists[i] = 1e10, stats);
+    auto t1 = std::chrono::steady_clock::now();
+
+    const double s = std::chrono::duration<double>(t1 - t0).count();
+    std::cout << 2 * D << "-DOP" << (sizeof(typename Node::value_type) < sizeof(double) ? ", float nodes" : "") << ": " << stats.nodes / (double)orgs.size() << " nodes, "
+              << stats.primitives / (double)orgs.size() << " primitives per ray, "
+              << orgs.size() / s * 1e-6 << " Mrays/s" << std::endl;
+}
+
+int main(int argc, const char **argv)
+{
+    const int nt = argc > 1 ? std::atoi(argv[1]) : 200000;
+    const int nr = argc > 2 ? std::atoi(argv[2]) : 200000;
+
+    // populate data
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    std::vector<Triangle> tris(nt);
+    for (auto &t : tris)
+    {
+        Vec3 c { uniform(rng), uniform(rng), uniform(rng) };
+        if (&t - tris.data() < nt / 4) c = c * 0.05; // dense cluster
+        for (auto &v : t.v) v = c + Vec3 { uniform(rng), uniform(rng), uniform(rng) } * 0.02;
+    }
+
+    std::vector<Vec3> orgs(nr), dirs(nr);
+    for (int i = 0; i < nr; ++i)
+    {
+        orgs[i] = Vec3 { uniform(rng), uniform(rng), uniform(rng) } * 2.0;
+        dirs[i] = normalize(Vec3 { uniform(rng), uniform(rng), uniform(rng) });
+    }
+
+    // build accel
+    Bvh<Triangle, double, 3> bvh;
+    TriangleBound bound;
+    SAHSplit<Triangle, TriangleBound, double, 3> split(bound);
+    bvh.build(tris, bound, split, 4);
+
+    using Clock = std::chrono::steady_clock;
+
+    std::vector<double> d0(nr, 1e10), d1(nr, 1e10);
+    TriangleCollide collide;
+    auto t0 = Clock::now();
+    size_t h0 { 0 };
+    for (int i = 0; i < nr; ++i)
+        if (bvh.intersect(collide, orgs[i], dirs[i], d0[i])) ++h0;
+    auto t1 = Clock::now();
+
+    // interleaving hides memory latency, so it does not beat one at a time
+    // while the tree fits in cache, as it does with the default sizes;
+    // run with 2000000 triangles for a tree well beyond the caches
+    TriangleBatchCollide batch;
+    size_t h1 = bvh.intersect_batch(batch, orgs.data(), dirs.data(), d1.data(), nr, 16);
+    auto t2 = Clock::now();
+
+    const double s0 = std::chrono::duration<double>(t1 - t0).count();
+    const double s1 = std::chrono::duration<double>(t2 - t1).count();
+    std::cout << "one at a time: " << h0 << " hits, " << nr / s0 * 1e-6 << " Mrays/s" << std::endl;
+    std::cout << "interleaved:   " << h1 << " hits, " << nr / s1 * 1e-6 << " Mrays/s" << std::endl;
+    std::cout << "same results = " << (d0 == d1) << std::endl;
+
+    // k nearest hits and swept boxes against scans of all triangles,
+    // half of the rays aimed through the dense cluster
+    std::mt19937 qrng(1);
+    const int nq = std::min(nr, 1000);
+    const auto &prims = bvh.primitives();
+    size_t nmulti { 0 }, nswept { 0 };
+    bool multi { true }, swept { true };
+    for (int i = 0; i < nq; ++i)
+    {
+        Vec3 org = orgs[i], dir = dirs[i];
+        if (i % 2) dir = normalize(Vec3 { uniform(qrng), uniform(qrng), uniform(qrng) } * 0.05 - org);
+
+        std::vector<std::pair<double, int>> hits, scan;
+        bvh.intersect_multi(collide, org, dir, hits, 8);
+        for (int j = 0; j < nt; ++j)
+        {
+            double d = std::numeric_limits<double>::max();
+            if (collide(prims[j], org, dir, d)) scan.push_back({ d, j });
+        }
+        std::sort(scan.begin(), scan.end());
+        if (scan.size() > 8) scan.resize(8);
+        multi &= hits.size() == scan.size();
+        for (size_t j = 0; multi && j < hits.size(); ++j) multi &= hits[j].first == scan[j].first;
+        nmulti += hits.size();
+
+        const Vec3 extent = Vec3 { uniform(qrng) + 1, uniform(qrng) + 1, uniform(qrng) + 1 } * 0.02;
+        const Vec3 motion = dir * (uniform(qrng) + 1.5);
+        auto impact = [&] (const Triangle &t, const Vec3 &o, const Vec3 &m, double &toi)
+        {
+            auto b = bound(t);
+            b[0] = b[0] - extent; b[1] = b[1] + extent;
+            const Vec3 k0 = (b[0] - o) / m, k1 = (b[1] - o) / m;
+            const double t0 = max(min(k0, k1)), t1 = min(max(k0, k1));
+            if (t0 > t1 || t1 < 0 || t0 >= toi) return false;
+            toi = std::max(t0, 0.0); return true;
+        };
+        double toi { 1 }, first { 1 };
+        bvh.sweep(impact, extent, org, motion, toi);
+        for (int j = 0; j < nt; ++j) impact(prims[j], org, motion, first);
+        swept &= toi == first;
+        nswept += toi < 1;
+    }
+    std::cout << "8 nearest hits of " << nq << " rays: " << nmulti << " hits, same as scan = " << multi << std::endl;
+    std::cout << "swept boxes of " << nq << " rays: " << nswept << " hit, same as scan = " << swept << std::endl;
+
+    // leaf sizes by SAH cost instead of a fixed threshold
+    std::vector<Triangle> copies = bvh.primitives();
+    Bvh<Triangle, double, 3> cbvh;
+    split.maxLeafSize = 16;
+    split.costTraversal = argc > 3 ? std::atof(argv[3]) : 4;
+    split.costIntersect = argc > 4 ? std::atof(argv[4]) : 1;
+    cbvh.build(copies, bound, split, 1, 48);
+
+    std::vector<double> d2(nr, 1e10);
+    auto t3 = Clock::now();
+    size_t h2 { 0 };
+    for (int i = 0; i < nr; ++i)
+        if (cbvh.intersect(collide, orgs[i], dirs[i], d2[i])) ++h2;
+    auto t4 = Clock::now();
+
+    const double s2 = std::chrono::duration<double>(t4 - t3).count();
+    auto r0 = tree_report(bvh, split.costTraversal, split.costIntersect);
+    auto r1 = tree_report(cbvh, split.costTraversal, split.costIntersect);
+    std::cout << "threshold: " << r0.nodes << " nodes, depth " << r0.depth << ", SAH cost " << r0.cost << std::endl;
+    std::cout << "SAH cost:  " << r1.nodes << " nodes, depth " << r1.depth << ", SAH cost " << r1.cost << ", "
+              << h2 << " hits, " << nr / s2 * 1e-6 << " Mrays/s, same results = " << (d0 == d2) << std::endl;
+    std::cout << "leaf sizes:";
+    for (size_t k = 1; k < r1.sizes.size(); ++k) std::cout << " " << r1.sizes[k];
+    std::cout << std::endl;
+
+    // lazy build, queried in a corner only
+    std::vector<Triangle> lazies = cbvh.primitives();
+    SAHSplit<Triangle, TriangleBound, double, 3> lsplit(bound);
+    LazyBvh<Triangle, double, 3, TriangleBound, decltype(lsplit)> lbvh(bound, lsplit);
+    auto t5 = Clock::now();
+    lbvh.build(lazies, 4, 6);
+    auto t6 = Clock::now();
+
+    std::vector<double> d3(nr, 1e10), d4(nr, 1e10);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < 4; ++t) workers.emplace_back([&, t]
+    {
+        for (int i = t; i < nr; i += 4)
+        {
+            Vec3 org = Vec3 { 0.9, 0.9, 0.9 } + orgs[i] * 0.05;
+            bvh.intersect(collide, org, dirs[i], d3[i] = 0.2);
+            lbvh.intersect(collide, org, dirs[i], d4[i] = 0.2);
+        }
+    });
+    for (auto &worker : workers) worker.join();
+
+    const double s3 = std::chrono::duration<double>(t6 - t5).count();
+    std::cout << "lazy: " << lbvh.expanded() << " of " << lbvh.deferred() << " subtrees built, top built in "
+              << s3 * 1e3 << " ms, same results = " << (d3 == d4) << std::endl;
+
+    // local edits, rebuilt in place
+    std::vector<int> dirty;
+    for (int i = 0; i < nt; ++i)
+        if (norm2(centroid(bound(bvh.primitives()[i])) - Vec3 { 0.5, 0.5, 0.5 }) < 0.1) dirty.push_back(i);
+    for (int i : dirty) for (auto &v : bvh.primitives()[i].v) v = v + Vec3 { uniform(rng), uniform(rng), uniform(rng) } * 0.01;
+    auto t7 = Clock::now();
+    bvh.rebuild(dirty, bound, split, 4);
+    auto t8 = Clock::now();
+    const size_t garbage = bvh.garbage();
+    bvh.compact();
+
+    std::vector<Triangle> edited = bvh.primitives();
+    Bvh<Triangle, double, 3> ebvh;
+    auto t9 = Clock::now();
+    ebvh.build(edited, bound, split, 4);
+    auto t10 = Clock::now();
+
+    std::vector<double> d5(nr, 1e10), d6(nr, 1e10);
+    for (int i = 0; i < nr; ++i)
+    {
+        bvh.intersect(collide, orgs[i], dirs[i], d5[i]);
+        ebvh.intersect(collide, orgs[i], dirs[i], d6[i]);
+    }
+
+    const double s4 = std::chrono::duration<double>(t8 - t7).count();
+    const double s5 = std::chrono::duration<double>(t10 - t9).count();
+    bool rejected { false };
+    try { bvh.rebuild({ nt }, bound, split, 4); } catch (const std::out_of_range &) { rejected = true; }
+
+    std::cout << "rebuild " << dirty.size() << " edits: " << s4 * 1e3 << " ms vs full build " << s5 * 1e3 << " ms, "
+              << garbage << " nodes compacted, same results = " << (d5 == d6) << ", bad position rejected = " << rejected << std::endl;
+
+    // depth cap kept through rebuilds
+    std::vector<Triangle> capped = bvh.primitives();
+    Bvh<Triangle, double, 3> dbvh;
+    dbvh.build(capped, bound, split, 1, 10);
+    std::vector<int> near;
+    for (int i = 0; i < nt; ++i)
+        if (norm2(centroid(bound(dbvh.primitives()[i])) - Vec3 { 0.5, 0.5, 0.5 }) < 0.1) near.push_back(i);
+    for (int i : near) for (auto &v : dbvh.primitives()[i].v) v = v + Vec3 { uniform(rng), uniform(rng), uniform(rng) } * 0.01;
+    dbvh.rebuild(near, bound, split, 1, 10);
+    std::cout << "rebuild " << near.size() << " edits under max depth 10: within depth = "
+              << (tree_report(dbvh, split.costTraversal, split.costIntersect).depth <= 10) << std::endl;
+
+    // tiles built apart, then merged
+    std::vector<std::vector<Triangle>> tiles(4);
+    for (const auto &t : ebvh.primitives())
+    {
+        auto c = centroid(bound(t));
+        tiles[(c[0] < 0 ? 0 : 1) + (c[1] < 0 ? 0 : 2)].push_back(t);
+    }
+
+    Bvh<Triangle, double, 3> tbvh[4], mbvh;
+    workers.clear();
+    for (int t = 0; t < 4; ++t) workers.emplace_back([&, t] { tbvh[t].build(tiles[t], bound, split, 4); });
+    for (auto &worker : workers) worker.join();
+
+    auto t11 = Clock::now();
+    mbvh.merge_trees({ &tbvh[0], &tbvh[3], &tbvh[1], &tbvh[2] }); // neighbors apart in the list
+    auto t12 = Clock::now();
+
+    std::vector<double> d7(nr, 1e10);
+    for (int i = 0; i < nr; ++i)
+        mbvh.intersect(collide, orgs[i], dirs[i], d7[i]);
+
+    const double s6 = std::chrono::duration<double>(t12 - t11).count();
+    std::cout << "merge 4 tiles: " << s6 * 1e3 << " ms vs full build " << s5 * 1e3 << " ms, SAH cost "
+              << tree_report(mbvh).cost << " vs " << tree_report(ebvh).cost << ", same results = " << (d6 == d7) << std::endl;
+
+    // uneven tiles along x, the first one holds most primitives
+    std::vector<std::vector<Triangle>> slabs(8);
+    for (size_t k = 0; k < slabs.size(); ++k)
+    {
+        slabs[k].resize(k == 0 ? nt / 4 : nt / 400 + 1);
+        for (auto &t : slabs[k])
+        {
+            Vec3 c { (uniform(rng) + 1 + 2 * k) / 16, uniform(rng) * 0.5 + 0.5, uniform(rng) * 0.5 + 0.5 };
+            for (auto &v : t.v) v = c + Vec3 { uniform(rng), uniform(rng), uniform(rng) } * 0.005;
+        }
+    }
+
+    std::vector<Bvh<Triangle, double, 3>> sbvhs(slabs.size());
+    std::vector<const Bvh<Triangle, double, 3>*> sptrs;
+    std::vector<Triangle> sall;
+    for (size_t k = 0; k < slabs.size(); ++k)
+    {
+        sall.insert(sall.end(), slabs[k].begin(), slabs[k].end());
+        sbvhs[k].build(slabs[k], bound, split, 4);
+        sptrs.push_back(&sbvhs[k]);
+    }
+
+    Bvh<Triangle, double, 3> ubvh, fbvh;
+    ubvh.merge_trees(sptrs);
+    fbvh.build(sall, bound, split, 4);
+    std::cout << "merge 8 uneven tiles: SAH cost " << tree_report(ubvh).cost << " vs " << tree_report(fbvh).cost << std::endl;
+
+    // edits crossing tiles climb to the top of the merged tree, then
+    // every primitive must still be under exactly one reachable leaf
+    std::vector<int> moved;
+    for (int i = 0; i < (int)mbvh.primitives().size(); i += 97) moved.push_back(i);
+    for (int i : moved) for (auto &v : mbvh.primitives()[i].v) v = v + Vec3 { uniform(rng), uniform(rng), 0.0 } * 0.5;
+    mbvh.rebuild(moved, bound, split, 4);
+
+    std::vector<int> reached(mbvh.primitives().size(), 0);
+    auto all = [] (const Box3 &) { return true; };
+    auto count = [&] (int ib, int ie) { for (int i = ib; i < ie; ++i) ++reached[i]; return false; };
+    mbvh.traverse<DepthFirst, AllHits>(all, count);
+
+    std::vector<Triangle> remerged = mbvh.primitives();
+    Bvh<Triangle, double, 3> rbvh;
+    rbvh.build(remerged, bound, split, 4);
+    std::vector<double> d8(nr, 1e10), d9(nr, 1e10);
+    for (int i = 0; i < nr; ++i)
+    {
+        mbvh.intersect(collide, orgs[i], dirs[i], d8[i]);
+        rbvh.intersect(collide, orgs[i], dirs[i], d9[i]);
+    }
+
+    std::cout << "rebuild " << moved.size() << " edits of merged tree: every primitive reached once = "
+              << (std::count(reached.begin(), reached.end(), 1) == (long)reached.size()) << ", same results = " << (d8 == d9) << std::endl;
+
+    // small range queries entering from a grid
+    std::vector<Box3> regions(nr);
+    for (auto &r : regions) { Vec3 c { uniform(rng), uniform(rng), uniform(rng) }; r = make_aabb<double, 3>(c - 0.005, c + 0.005); }
+
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        EntryGrid<Triangle, double, 3> grid(ebvh, pass == 0 ? 1 : 16, pass == 2);
+        BoxSearch query;
+        TraversalStats stats;
+        auto t13 = Clock::now();
+        for (const auto &r : regions) { query.box = r; grid.search(query, r, stats); }
+        auto t14 = Clock::now();
+
+        const double s7 = std::chrono::duration<double>(t14 - t13).count();
+        std::cout << (pass == 0 ? "root:        " : pass == 1 ? "grid 16^3:   " : "hashed 16^3: ") << query.count << " found, "
+                  << stats.nodes / (double)nr << " nodes per query, " << nr / s7 * 1e-6 << " Mqueries/s, "
+                  << grid.memory() / 1024 << " KiB" << std::endl;
+    }
+
+    // points binned into a cell may lie a few ulps past its face, so
+    // put primitives right there, touching regions held by the cell
+    const Vec3 ga { -0.9, -0.8, -0.7 }, gb { 0.7, 0.8, 0.9 };
+    const Vec3 gsize = diagonal(make_aabb<double, 3>(ga, gb)) / 16.0;
+    std::vector<Triangle> edges { Triangle { { ga, ga, ga } }, Triangle { { gb, gb, gb } } };
+    std::vector<Box3> touching;
+    for (size_t d = 0; d < 3; ++d) for (int j = 1; j < 16; ++j) for (int k = -8; k <= 8; ++k)
+    {
+        double v = ga[d] + gsize[d] * j; // a face as the grid sees it
+        for (int s = 0; s < std::abs(k); ++s) v = std::nextafter(v, k * 2.0);
+        const size_t c = (size_t)((v - ga[d]) / gsize[d]);
+        const double sign = v > ga[d] + gsize[d] * (c + 1) ? 1 : v < ga[d] + gsize[d] * c ? -1 : 0;
+        if (sign == 0) continue;
+
+        // region on the side of the cell, primitive on the other
+        const Vec3 mid = ga + gsize * Vec3 { (double)(rng() % 16) + 0.5, (double)(rng() % 16) + 0.5, (double)(rng() % 16) + 0.5 };
+        Vec3 lo = mid - gsize * 0.25, hi = mid + gsize * 0.25;
+        lo[d] = sign > 0 ? v - gsize[d] * 0.5 : v; hi[d] = sign > 0 ? v : v + gsize[d] * 0.5;
+        touching.push_back(make_aabb<double, 3>(lo, hi));
+        Triangle t { { mid, mid + gsize * 0.1, mid - gsize * 0.1 } };
+        for (auto &p : t.v) p[d] = v + sign * std::abs(p[d] - mid[d]);
+        edges.push_back(t);
+    }
+
+    Bvh<Triangle, double, 3> gbvh;
+    gbvh.build(edges, bound, split, 1);
+    size_t found[3] {};
+    for (int pass = 0; pass < 3; ++pass)
+    {
+        EntryGrid<Triangle, double, 3> grid(gbvh, pass == 0 ? 1 : 16, pass == 2);
+        BoxSearch query;
+        for (const auto &r : touching) { query.box = r; grid.search(query, r); }
+        found[pass] = query.count;
+    }
+    std::cout << touching.size() << " regions on cell faces: " << found[0] << " found, grid same = " << (found[1] == found[0])
+              << ", hashed same = " << (found[2] == found[0]) << std::endl;
+
+    // many small trees
+    const auto &parts = ebvh.primitives();
+    std::vector<size_t> ranges { 0 };
+    while (ranges.back() < (size_t)nt) ranges.push_back(std::min<size_t>(ranges.back() + 1 + rng() % 40, nt));
+    const size_t nTrees = ranges.size() - 1;
+
+    auto t15 = Clock::now();
+    std::vector<Bvh<Triangle, double, 3>> singles(nTrees);
+    for (size_t k = 0; k < nTrees; ++k)
+    {
+        std::vector<Triangle> part(parts.begin() + ranges[k], parts.begin() + ranges[k + 1]);
+        singles[k].build(part, bound, split, 4);
+    }
+    auto t16 = Clock::now();
+    BvhForest<Triangle, double, 3> forest;
+    forest.build(parts, ranges, bound, split, 4, 1);
+    auto t17 = Clock::now();
+    forest.build(parts, ranges, bound, split, 4, 4);
+    auto t18 = Clock::now();
+
+    bool same { true };
+    for (int i = 0; i < nr; ++i)
+    {
+        const size_t k = i % nTrees;
+        double da { 1e10 }, db { 1e10 };
+        Vec3 org = centroid(forest.tree(k).aabb()) - dirs[i];
+        singles[k].intersect(collide, org, dirs[i], da);
+        forest.tree(k).intersect(collide, org, dirs[i], db);
+        same = same && da == db;
+    }
+
+    const double s8 = std::chrono::duration<double>(t16 - t15).count();
+    const double s9 = std::chrono::duration<double>(t17 - t16).count();
+    const double s10 = std::chrono::duration<double>(t18 - t17).count();
+    std::cout << nTrees << " small trees: one by one " << s8 * 1e3 << " ms, forest " << s9 * 1e3 << " ms, on 4 threads "
+              << s10 * 1e3 << " ms, "
+              << forest.nodes().size() << " pooled nodes, same results = " << same << std::endl;
+
+    // diagonal slivers bounded by DOPs
+    std::vector<Triangle> slivers(nt);
+    for (auto &t : slivers)
+    {
+        Vec3 c { uniform(rng), uniform(rng), uniform(rng) };
+        Vec3 a { uniform(rng) < 0 ? -1.0 : 1.0, uniform(rng) < 0 ? -1.0 : 1.0, 1 };
+        Vec3 w { uniform(rng), uniform(rng), uniform(rng) };
+        t.v[0] = c - a * 0.05; t.v[1] = c + a * 0.05; t.v[2] = c + w * 0.005;
+    }
+
+    std::vector<double> e3(nr), e7(nr), e9(nr), f7(nr);
+    trace_dop<3>(slivers, orgs, dirs, e3);
+    trace_dop<7>(slivers, orgs, dirs, e7);
+    trace_dop<9>(slivers, orgs, dirs, e9);
+    trace_dop<7, BvhNode<float, 3, int64_t>>(slivers, orgs, dirs, f7);
+    std::cout << "same results = " << (e3 == e7 && e3 == e9 && e3 == f7) << std::endl;
+
+    return 0;
+}
@@ -1,4 +1,14 @@
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <set>
 #include "bvh.hh"
+#include "snapshot.hh"
+#include "triangle.hh"
+#include "sfc.hh"
+#include "temporal.hh"
+#include "winding.hh"
 
 using Vec3 = VectorN<double, 3>;
 using Int3 = VectorN<int, 3>;
@@ -75,6 +85,59 @@ inline bool TriangleCollide::operator() (int fid, const Vec3 &org, const Vec3 &d
     return hit;
 }
 
+struct TriangleOverlap
+{
+    TriangleOverlap(const TriangleBound &bound): bound(bound) {}
+    inline bool operator() (int fa, int fb);
+    const TriangleBound &bound;
+    std::atomic<int> count { 0 };
+};
+
+inline bool TriangleOverlap::operator() (int fa, int fb)
+{
+    // boxes of the two triangles as a coarse overlap test
+    bool hit = is_intersecting(bound(fa), bound(fb));
+    if (hit) ++count;
+    return hit;
+}
+
+struct TriangleCull
+{
+    inline bool operator() (int fid, bool contained) { ++count; if (contained) ++inside; return true; }
+    int count { 0 };
+    int inside { 0 };
+};
+
+struct CollectAll
+{
+    inline bool operator() (const Box3 &) const { return true; }
+    inline bool operator() (int id) { ids.push_back(id); return true; }
+    std::vector<int> ids;
+};
+
+struct MovingTriangleBound // moving along +x by 4 over time [0, 1]
+{
+    MovingTriangleBound(const TriangleBound &bound): bound(bound) {}
+    inline Box3 operator() (int fid, size_t key) const { auto b = bound(fid); Vec3 d { 4.0 * key, 0, 0 }; return { b[0] + d, b[1] + d }; }
+    const TriangleBound &bound;
+};
+
+struct MovingTriangleCollide
+{
+    MovingTriangleCollide(const std::vector<Vec3> &vs, const std::vector<Int3> &fs): vs(vs), fs(fs) {}
+    inline bool operator() (int fid, const Vec3 &org, const Vec3 &dir, double time, double &dist) const
+    {
+        const auto &f = fs[fid];
+        const Vec3 d { 4.0 * time, 0, 0 };
+        bool hit = is_intersecting(vs[f[0]] + d, vs[f[1]] + d, vs[f[2]] + d, org, dir, dist, true);
+        if (hit) fc = fid;
+        return hit;
+    }
+    const std::vector<Vec3> &vs;
+    const std::vector<Int3> &fs;
+    mutable int fc { -1 };
+};
+
 static void set_obj_box(std::vector<Vec3> &vs, std::vector<Int3> &fs)
 {
     vs.resize(8); fs.resize(12);
@@ -94,6 +157,27 @@ static void set_obj_box(std::vector<Vec3> &vs, std::vector<Int3> &fs)
     fs[10]= Int3 { 5, 6, 8 } - 1; fs[11]= Int3 { 5, 8, 7 } - 1;
 }
 
+// unit sphere of nu rings by nv segments, faces wound outward
+void set_obj_sphere(std::vector<Vec3>& vs, std::vector<Int3>& fs, int nu, int nv)
+{
+    const double pi = std::acos(-1.0);
+    vs.clear(); fs.clear();
+    vs.push_back({ 0, 0, 1 });
+    for (int i = 1; i < nu; ++i) for (int j = 0; j < nv; ++j)
+    {
+        const double a = pi * i / nu, b = 2 * pi * j / nv;
+        vs.push_back({ std::sin(a) * std::cos(b), std::sin(a) * std::sin(b), std::cos(a) });
+    }
+    vs.push_back({ 0, 0, -1 });
+
+    auto at = [&] (int i, int j) { return i == 0 ? 0 : i == nu ? (int)vs.size() - 1 : 1 + (i - 1) * nv + j % nv; };
+    for (int i = 0; i < nu; ++i) for (int j = 0; j < nv; ++j)
+    {
+        if (i > 0) fs.push_back({ at(i, j), at(i + 1, j + 1), at(i, j + 1) });
+        if (i < nu - 1) fs.push_back({ at(i, j), at(i + 1, j), at(i + 1, j + 1) });
+    }
+}
+
 int main(int argc, const char **argv)
 {
     std::vector<Vec3> vs {};
@@ -117,5 +201,315 @@ int main(int argc, const char **argv)
     const auto &f = fs[collide.fc];
     std::cout << collide.fc << ": [" << vs[f[0]] << ", " << vs[f[1]] << ", " << vs[f[2]] << "], d = " << dist << std::endl;
 
+    dist = 1e10;
+    std::cout << "occluded = " << bvh.occluded(collide, { -2, 0, 0 }, { 1, 0, 0 }, dist) << std::endl; {
+    TraversalStats stats;
+    Vec3 org { -2, 0, 0 }, dir { 1, 0, 0 };
+    RayNodeTest<double, 3> test(org, dir, dist = 1e10);
+    auto visit = [&] (int ib, int ie) { bool hit { false }; for (int i = ib; i < ie; ++i) hit |= collide(bvh.primitives()[i], org, dir, dist); return hit; };
+    bvh.traverse<NearFirst, AllHits>(test, visit, stats);
+    std::cout << "visited nodes = " << stats.nodes << ", leaves = " << stats.leaves << ", primitives = " << stats.primitives << std::endl; }
+ {
+    std::vector<std::pair<double, int>> hits; // both sides of faces
+    auto through = [&] (int fid, const Vec3 &org, const Vec3 &dir, double &d) { const auto &f = fs[fid]; return is_intersecting(vs[f[0]], vs[f[1]], vs[f[2]], org, dir, d, false); };
+    bvh.intersect_multi(through, { -2, 0.3, 0.1 }, { 1, 0, 0 }, hits, 4);
+    std::cout << "hits along ray:";
+    for (const auto &hit : hits) std::cout << " " << bvh.primitives()[hit.second] << " at d = " << hit.first << ";";
+    std::cout << std::endl; }
+ {
+    Vec3 extent { 0.25, 0.25, 0.25 }; // box swept against boxes of faces
+    auto impact = [&] (int fid, const Vec3 &org, const Vec3 &dir, double &t)
+    {
+        auto b = bound(fid);
+        b[0] = b[0] - extent; b[1] = b[1] + extent;
+        const Vec3 k0 = (b[0] - org) / dir, k1 = (b[1] - org) / dir;
+        const double t0 = max(min(k0, k1)), t1 = min(max(k0, k1));
+        if (t0 > t1 || t1 < 0 || t0 >= t) return false;
+        t = std::max(t0, 0.0); return true;
+    };
+    double toi { 1e10 };
+    bvh.sweep(impact, extent, { -3, 0.5, 0.5 }, { 1, 0, 0 }, toi);
+    std::cout << "swept box hits at t = " << toi << std::endl; }
+
+    TriangleOverlap overlap(bound);
+    bvh.overlap(overlap);
+    std::cout << "self overlapping pairs = " << overlap.count << std::endl;
+
+    overlap.count = 0;
+    AffineTransform<double, 3> move { { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } }, { 1.5, 0, 0 } };
+    bvh.overlap(bvh, overlap, move, 4);
+    std::cout << "moved overlapping pairs = " << overlap.count << std::endl; {
+
+    // pairs found against all pairs of a random box soup, also on several threads
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<double> uniform(0, 10);
+    std::vector<Box3> boxes(400);
+    for (auto &b : boxes) { Vec3 c { uniform(rng), uniform(rng), uniform(rng) }; b = { c - 0.4, c + 0.4 }; }
+    auto bbound = [&] (int i) { return boxes[i]; };
+    SAHSplit<int, decltype(bbound), double, 3> bsplit(bbound);
+    std::vector<int> ids(boxes.size()); std::iota(ids.begin(), ids.end(), 0);
+    Bvh<int, double, 3> sbvh;
+    sbvh.build(ids, bbound, bsplit, 4);
+
+    std::set<std::pair<int, int>> brute, bruteMoved;
+    for (int i = 0; i < (int)boxes.size(); ++i)
+        for (int j = 0; j < (int)boxes.size(); ++j)
+        {
+            if (i < j && is_intersecting(boxes[i], boxes[j])) brute.insert({ i, j });
+            if (is_intersecting(boxes[i], move(boxes[j]))) bruteMoved.insert({ i, j });
+        }
+
+    for (int threads : { 1, 4 })
+    {
+        std::mutex mutex;
+        std::set<std::pair<int, int>> found, foundMoved;
+        int repeated { 0 };
+        auto self = [&] (int a, int b)
+        {
+            if (!is_intersecting(boxes[a], boxes[b])) return false;
+            std::lock_guard<std::mutex> lock(mutex);
+            repeated += !found.insert({ std::min(a, b), std::max(a, b) }).second;
+            return true;
+        };
+        auto moved = [&] (int a, int b)
+        {
+            if (!is_intersecting(boxes[a], move(boxes[b]))) return false;
+            std::lock_guard<std::mutex> lock(mutex);
+            repeated += !foundMoved.insert({ a, b }).second;
+            return true;
+        };
+        sbvh.overlap(self, threads);
+        sbvh.overlap(sbvh, moved, move, threads);
+        std::cout << threads << " thread(s): self pairs = " << found.size() << ", moved pairs = " << foundMoved.size()
+                  << ", same as brute force = " << (found == brute && foundMoved == bruteMoved && repeated == 0) << std::endl;
+    } }
+
+    TriangleCull cull;
+    bvh.cull(cull, { { { 1, 0, 0 }, 0.5 }, { { 0, -1, 0 }, 2 } }); // x <= 0.5, y >= -2
+    std::cout << "culled triangles = " << cull.count << ", inside = " << cull.inside << std::endl;
+
+    // against every triangle box classified on its own, one triangle per leaf
+    for (const auto &planes : std::vector<std::vector<Halfspace<double, 3>>> {
+        { { { 1, 0, 0 }, 0.5 }, { { 0, -1, 0 }, 2 } },             // x <= 0.5, y >= -2
+        { { { 1, 1, 0 }, 0.5 }, { { 0, 0, -1 }, 0 } },              // x + y <= 0.5, z >= 0
+        { { { 1, 0, 0 }, 1 }, { { -1, 0, 0 }, 1 }, { { 0, 1, 0 }, 1 } } }) // -1 <= x <= 1, y <= 1
+    {
+        std::set<int> culled, inside, bruteCulled, bruteInside;
+        auto query = [&] (int fid, bool contained) { culled.insert(fid); if (contained) inside.insert(fid); return true; };
+        bvh.cull(query, planes);
+
+        for (int fid = 0; fid < (int)fs.size(); ++fid)
+        {
+            bool outside { false }, within { true };
+            for (const auto &h : planes)
+            {
+                const int side = classify(bound(fid), h.n, h.d);
+                outside |= side > 0;
+                within &= side < 0;
+            }
+            if (!outside) bruteCulled.insert(fid);
+            if (within) bruteInside.insert(fid);
+        }
+
+        std::cout << "culled " << culled.size() << ", inside " << inside.size()
+                  << ", same as per triangle = " << (culled == bruteCulled && inside == bruteInside) << std::endl;
+    }
+
+    SnapshotBvh<int, double, 3> scene;
+    auto rebuilt = scene.rebuild_async([&] (Bvh<int, double, 3> &tree)
+    {
+        SAHSplit<int, TriangleBound, double, 3> split(bound);
+        std::vector<int> fids {}; for (int i=0; i<fs.size(); ++i) fids.push_back(i);
+        tree.build(fids, bound, split, 1);
+    });
+    while (scene.generation() == 0)
+    {
+        auto tree = scene.snapshot(); // never blocked by the rebuild
+        double d { 1e10 };
+        tree->intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    }
+    rebuilt.get(); {
+    auto tree = scene.snapshot();
+    double d { 1e10 };
+    tree->intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    std::cout << "snapshot " << scene.generation() << ": " << collide.fc << ", d = " << d << std::endl; } {
+
+    // readers pin trees while a writer publishes generation g over ids [100 g, 100 g + 100)
+    using clock = std::chrono::steady_clock;
+    SnapshotBvh<int, double, 3> scene;
+    auto ibound = [] (int id) { Vec3 c { (double)(id % 10), (double)(id / 10 % 10), 0.0 }; return Box3 { c, c + 0.5 }; };
+    auto publish = [&] (int g)
+    {
+        scene.rebuild([&] (Bvh<int, double, 3> &tree)
+        {
+            std::vector<int> ids(100); std::iota(ids.begin(), ids.end(), 100 * g);
+            SAHSplit<int, decltype(ibound), double, 3> isplit(ibound);
+            tree.build(ids, ibound, isplit, 2);
+        });
+    };
+    publish(0);
+
+    std::atomic<bool> done { false };
+    std::atomic<int> torn { 0 }, reads { 0 };
+    std::vector<std::vector<double>> waits(3); // snapshot() calls in us
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 3; ++r) readers.emplace_back([&, r]
+    {
+        while (!done)
+        {
+            const auto t0 = clock::now();
+            auto tree = scene.snapshot();
+            waits[r].push_back(std::chrono::duration<double, std::micro>(clock::now() - t0).count());
+
+            // the whole tree is of one generation and every id is reached once
+            CollectAll all;
+            tree->search(all);
+            std::sort(all.ids.begin(), all.ids.end());
+            const int g = all.ids.empty() ? 0 : all.ids[0] / 100;
+            bool whole = all.ids.size() == 100;
+            for (int i = 0; whole && i < 100; ++i) whole = all.ids[i] == 100 * g + i;
+            torn += !whole;
+            ++reads;
+        }
+    });
+
+    // keep publishing until the readers got their share of the core
+    const auto t0 = clock::now();
+    int g { 0 };
+    while (++g <= 50 || reads < 10000) { publish(g); std::this_thread::yield(); }
+    const double writing = std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+    done = true;
+    for (auto &reader : readers) reader.join();
+
+    // the longest waits include readers preempted by the scheduler
+    std::vector<double> all;
+    for (const auto &w : waits) all.insert(all.end(), w.begin(), w.end());
+    std::sort(all.begin(), all.end());
+    std::cout << g - 1 << " publishes in " << writing << " ms under " << reads << " reads, torn reads = " << torn
+              << ", snapshot() median " << all[all.size() / 2] << " us, 99% " << all[all.size() * 99 / 100]
+              << " us, max " << all.back() << " us" << std::endl; }
+
+    Bvh<uint32_t, double, 3> ibvh;
+    std::vector<Int3> gs = fs; // faces to be reordered
+    build_indexed<SAHSplit>(ibvh, gs, [&] (const Int3 &f) { return make_aabb<double, 3>(vs[f[0]], vs[f[1]], vs[f[2]]); }, 1);
+    reorder(ibvh, gs); {
+    TriangleCollide collide(vs, gs);
+    double d { 1e10 };
+    ibvh.intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    const auto &g = gs[collide.fc];
+    std::cout << "indexed " << collide.fc << ": [" << vs[g[0]] << ", " << vs[g[1]] << ", " << vs[g[2]] << "], d = " << d << std::endl; }
+
+    TriangleLeaves<double> leaves;
+    leaves.build(bvh, [&] (int fid, Vec3 &v0, Vec3 &v1, Vec3 &v2) { v0 = vs[fs[fid][0]]; v1 = vs[fs[fid][1]]; v2 = vs[fs[fid][2]]; }); {
+    TriangleLeafCollide<double> collide(leaves);
+    double d { 1e10 };
+    bvh.intersect_leaves(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    std::cout << "leaf triangles " << bvh.primitives()[collide.slot] << ", d = " << d << std::endl; } {
+    TriangleLeafCollide<double, true> collide(leaves);
+    double d { 1e10 };
+    bvh.intersect_leaves(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    std::cout << "watertight " << bvh.primitives()[collide.slot] << ", d = " << d << std::endl; }
+
+    Bvh<int, double, 3, BvhNode<float, 3>> fbvh; // float nodes over double geometry
+    SAHSplit<int, TriangleBound, double, 3> split(bound); {
+    std::vector<int> fids {}; for (int i=0; i<fs.size(); ++i) fids.push_back(i);
+    fbvh.build(fids, bound, split, 1);
+    double d { 1e10 };
+    fbvh.intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    std::cout << "float nodes " << collide.fc << ", d = " << d << ", node size = " << sizeof(fbvh.nodes()[0]) << std::endl; }
+
+    Bvh<int, double, 3, BvhNode<double, 3, int64_t>> wbvh; { // 64-bit indices
+    std::vector<int> fids {}; for (int i=0; i<fs.size(); ++i) fids.push_back(i);
+    wbvh.build(fids, bound, split, 1);
+    double d { 1e10 };
+    wbvh.intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    std::cout << "64-bit indices " << collide.fc << ", d = " << d << ", node size = " << sizeof(wbvh.nodes()[0]) << std::endl;
+    TriangleLeaves<double> wleaves;
+    wleaves.build(wbvh, [&] (int fid, Vec3 &v0, Vec3 &v1, Vec3 &v2) { v0 = vs[fs[fid][0]]; v1 = vs[fs[fid][1]]; v2 = vs[fs[fid][2]]; });
+    TriangleLeafCollide<double, false, 8, int64_t> lcollide(wleaves);
+    wbvh.intersect_leaves(lcollide, { -2, 0, 0 }, { 1, 0, 0 }, d = 1e10);
+    std::cout << "64-bit leaf triangles " << wbvh.primitives()[lcollide.slot] << ", d = " << d << std::endl; }
+
+    Bvh<int, double, 3> dbvh[2]; { // same tree whatever the input order or thread
+    DeterministicSplit<decltype(split)> dsplit(split);
+    std::vector<int> fids {}; for (int i=0; i<fs.size(); ++i) fids.push_back(i);
+    std::vector<int> rids(fids.rbegin(), fids.rend());
+    dbvh[0].build(fids, bound, dsplit, 1);
+    std::thread worker([&] { dbvh[1].build(rids, bound, dsplit, 1); }); worker.join();
+    std::cout << "tree hash " << std::hex << tree_hash(dbvh[0]) << " = " << tree_hash(dbvh[1]) << std::dec << std::endl; }
+
+    std::vector<Vec3> ws = vs; // mesh reordered for locality
+    std::vector<Int3> hs = fs; {
+    auto forder = leaf_order(bvh);
+    auto vremap = vertex_remap(hs, forder, ws.size());
+    gather(hs, forder);
+    reindex(hs, vremap);
+    scatter(ws, vremap);
+    Bvh<int, double, 3> rbvh = bvh;
+    std::iota(rbvh.primitives().begin(), rbvh.primitives().end(), 0);
+    TriangleCollide collide(ws, hs);
+    double d { 1e10 };
+    rbvh.intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, d);
+    const auto &h = hs[collide.fc];
+    std::cout << "reordered " << collide.fc << ": [" << ws[h[0]] << ", " << ws[h[1]] << ", " << ws[h[2]] << "], d = " << d << std::endl; }
+
+    TemporalBvh<int, double, 3> tbvh; {
+    MovingTriangleBound mbound(bound);
+    std::vector<int> fids {}; for (int i=0; i<fs.size(); ++i) fids.push_back(i);
+    tbvh.build<SAHSplit>(fids, mbound, 1);
+    MovingTriangleCollide collide(vs, fs);
+    double d { 1e10 };
+    tbvh.intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, 0.5, d);
+    std::cout << "moving " << collide.fc << " at t = 0.5, d = " << d << std::endl;
+    TemporalBvh<int, double, 3, 2, BvhNode<float, 3, int64_t>> wtbvh; // float boxes, 64-bit indices
+    for (int i=0; i<fs.size(); ++i) fids.push_back(i);
+    wtbvh.build<SAHSplit>(fids, mbound, 1);
+    wtbvh.intersect(collide, { -2, 0, 0 }, { 1, 0, 0 }, 0.5, d = 1e10);
+    std::cout << "moving, float nodes " << collide.fc << " at t = 0.5, d = " << d << std::endl; }
+
+    WindingNumber<int, double> winding(bvh, [&] (int fid, Vec3 &v0, Vec3 &v1, Vec3 &v2) { v0 = vs[fs[fid][0]]; v1 = vs[fs[fid][1]]; v2 = vs[fs[fid][2]]; }); {
+    std::vector<Vec3> grid; // points of a 10^3 grid over [-2, 2]^3
+    for (int i = 0; i < 1000; ++i) grid.push_back(Vec3 { (double)(i % 10), (double)(i / 10 % 10), (double)(i / 100) } * 0.4 - 1.7);
+    std::vector<double> ws(grid.size());
+    winding.batch(grid.data(), ws.data(), grid.size(), 4);
+    int inside { 0 }, expected { 0 };
+    for (size_t i = 0; i < grid.size(); ++i) { inside += ws[i] > 0.5; expected += is_inside(bvh.aabb(), grid[i]); }
+    std::cout << "winding number at center = " << winding({ 0, 0, 0 }) << ", outside = " << winding({ 2, 0, 0 })
+              << ", grid points inside = " << inside << " = " << expected << std::endl; }
+
+    // closed sphere, exact numbers are 1 inside and 0 outside away from the surface
+    std::vector<Vec3> svs {};
+    std::vector<Int3> sfs {};
+    set_obj_sphere(svs, sfs, 32, 64); {
+    TriangleBound sbound(svs, sfs);
+    SAHSplit<int, TriangleBound, double, 3> split(sbound);
+    std::vector<int> fids {}; for (int i=0; i<sfs.size(); ++i) fids.push_back(i);
+    Bvh<int, double, 3> sbvh;
+    sbvh.build(fids, sbound, split, 4);
+    WindingNumber<int, double> swinding(sbvh, [&] (int fid, Vec3 &v0, Vec3 &v1, Vec3 &v2) { v0 = svs[sfs[fid][0]]; v1 = svs[sfs[fid][1]]; v2 = svs[sfs[fid][2]]; });
+
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> uniform(-2, 2);
+    std::vector<Vec3> ps;
+    while (ps.size() < 10000)
+    {
+        Vec3 p { uniform(rng), uniform(rng), uniform(rng) };
+        if (std::abs(std::sqrt(norm2(p)) - 1) > 0.05) ps.push_back(p);
+    }
+
+    std::vector<double> ws(ps.size()), ws1(ps.size());
+    swinding.batch(ps.data(), ws.data(), ps.size(), 4);
+    swinding.batch(ps.data(), ws1.data(), ps.size(), 1);
+    double err { 0 };
+    int agreed { 0 };
+    for (size_t i = 0; i < ps.size(); ++i)
+    {
+        const bool in = norm2(ps[i]) < 1;
+        err = std::max(err, std::abs(ws[i] - (in ? 1 : 0)));
+        agreed += swinding.is_inside(ps[i]) == in;
+    }
+    std::cout << "sphere winding numbers: max error " << err << " < 0.05 = " << (err < 0.05) << ", inside agrees for " << agreed << " of " << ps.size()
+              << ", 4 threads same as 1 = " << (ws == ws1) << std::endl; }
+
     return 0;
 }
\ No newline at end of file
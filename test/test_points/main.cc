@@ -0,0 +1,114 @@
+#include <random>
+#include <chrono>
+#include "points.hh"
+#include "highdim.hh"
+
+using Vec3 = VectorN<double, 3>;
+
+template <size_t N>
+void bench_highdim(size_t n, size_t nq, size_t k)
+{
+    using clock = std::chrono::high_resolution_clock;
+
+    // clustered feature vectors, queries from the same clusters
+    std::mt19937 rng(N);
+    std::normal_distribution<float> normal(0, 1);
+    std::uniform_int_distribution<size_t> pick(0, 63);
+    std::vector<float> centers(64 * N), data(n * N), queries(nq * N);
+    for (auto &x : centers) x = normal(rng);
+    for (size_t i = 0; i < n + nq; ++i)
+    {
+        float *p = i < n ? &data[i * N] : &queries[(i - n) * N];
+        const float *c = &centers[pick(rng) * N];
+        for (size_t d = 0; d < N; ++d) p[d] = c[d] + 0.15f * normal(rng);
+    }
+
+    std::vector<std::vector<float>> brute(nq);
+    auto t0 = clock::now();
+    for (size_t q = 0; q < nq; ++q)
+    {
+        std::vector<float> d2(n);
+        for (size_t i = 0; i < n; ++i)
+            d2[i] = sqr_distance_n<N>(&data[i * N], &queries[q * N]);
+        std::partial_sort(d2.begin(), d2.begin() + k, d2.end());
+        brute[q].assign(d2.begin(), d2.begin() + k);
+    }
+    auto t1 = clock::now();
+
+    PointBvh<float, N> boxes;
+    boxes.build(data.data(), n, 16);
+    std::vector<std::pair<float, uint32_t>> result;
+    auto t2 = clock::now();
+    bool same { true };
+    for (size_t q = 0; q < nq; ++q)
+    {
+        VectorN<float, N> v;
+        for (size_t d = 0; d < N; ++d) v[d] = queries[q * N + d];
+        boxes.knn(result, v, k);
+        for (size_t j = 0; j < k; ++j) same &= std::abs(result[j].first - brute[q][j]) <= 1e-5f * brute[q][j];
+    }
+    auto t3 = clock::now();
+
+    HighDimBvh<float, N> bvh;
+    bvh.build(data.data(), n, 16);
+    auto t4 = clock::now();
+    for (size_t q = 0; q < nq; ++q)
+    {
+        bvh.knn(result, &queries[q * N], k);
+        for (size_t j = 0; j < k; ++j) same &= std::abs(result[j].first - brute[q][j]) <= 1e-5f * brute[q][j];
+    }
+    auto t5 = clock::now();
+
+    auto ms = [](clock::time_point a, clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+    std::cout << "N = " << N << ", " << k << " nearest of " << n << ": brute force " << ms(t0, t1)
+        << " ms, full boxes " << ms(t2, t3) << " ms (" << boxes.nodes().size() * sizeof(boxes.nodes()[0]) / 1024
+        << " KB), high-dim " << ms(t4, t5) << " ms (" << bvh.memory() / 1024 << " KB), same results = " << same << std::endl;
+}
+
+struct PointCount
+{
+    inline void operator() (uint32_t id, double d2) { ++count; }
+    int count { 0 };
+};
+
+int main(int argc, const char **argv)
+{
+    // populate data
+    std::vector<double> xyz(3 * 10000);
+    std::mt19937 rng(0);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    for (auto &x : xyz) x = uniform(rng);
+
+    // build accel
+    PointBvh<double, 3> bvh;
+    bvh.build(xyz.data(), xyz.size() / 3, 16);
+
+    const Vec3 q { 0.1, -0.2, 0.3 };
+
+    PointCount count;
+    bvh.radius_search(count, q, 0.25);
+
+    int brute { 0 };
+    for (size_t i = 0; i < xyz.size() / 3; ++i)
+    {
+        Vec3 p { xyz[i*3], xyz[i*3+1], xyz[i*3+2] };
+        if (dot(p - q, p - q) <= 0.25 * 0.25) ++brute;
+    }
+    std::cout << "radius search = " << count.count << ", brute force = " << brute << std::endl;
+
+    std::vector<std::pair<double, uint32_t>> knn;
+    bvh.knn(knn, q, 5);
+    for (const auto &r : knn)
+        std::cout << r.second << ": d = " << std::sqrt(r.first) << std::endl;
+
+    PointBvh<double, 3, int64_t> wide; // 64-bit indices for huge clouds
+    wide.build(xyz.data(), xyz.size() / 3, 16);
+    std::vector<std::pair<double, uint64_t>> wknn;
+    wide.knn(wknn, q, 1);
+    std::cout << "64-bit nearest = " << wknn[0].second << ", nodes = " << wide.nodes().size() << std::endl;
+
+    bench_highdim<32>(50000, 500, 10);
+    bench_highdim<128>(50000, 500, 10);
+
+    return 0;
+}